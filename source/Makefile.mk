@@ -46,7 +46,23 @@ BASE_FLAGS += -DNDEBUG $(BASE_OPTS) -fvisibility=hidden
 CXXFLAGS   += -fvisibility-inlines-hidden
 endif
 
-LINK_OPTS += $(shell pkg-config --libs sndfile fftw3f samplerate)
+LINK_OPTS += $(shell pkg-config --libs sndfile samplerate)
+
+# --------------------------------------------------------------
+# FFT backends, the built-in FFT is always available
+
+FFTW ?= true
+
+ifeq ($(FFTW),true)
+BASE_FLAGS += -DHAVE_FFTW
+FFTW_LIBS   = $(shell pkg-config --libs fftw3f)
+LINK_OPTS  += $(FFTW_LIBS)
+endif
+
+# --------------------------------------------------------------
+# Compile the default IR and its kernels into the plugin
+
+EMBED_IR ?= true
 
 BUILD_C_FLAGS   = $(BASE_FLAGS) -std=c99 -std=gnu99 $(CFLAGS)
 BUILD_CXX_FLAGS = $(BASE_FLAGS) -std=c++11 $(CXXFLAGS) $(CPPFLAGS)
@@ -56,7 +72,7 @@ ifeq ($(MACOS),true)
 LINK_FLAGS      = $(LINK_OPTS) $(LDFLAGS)
 else
 # add 'no-undefined'
-LINK_FLAGS      = $(LINK_OPTS) -Wl,--no-undefined $(LDFLAGS) -lsndfile $(shell pkg-config --libs fftw3f) -lsamplerate
+LINK_FLAGS      = $(LINK_OPTS) -Wl,--no-undefined $(LDFLAGS) -lsndfile $(FFTW_LIBS) -lsamplerate
 endif
 
 # --------------------------------------------------------------
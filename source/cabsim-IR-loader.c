@@ -4,9 +4,6 @@
   Copyright 2011 Gabriel M. Beddingfield <gabriel@teuton.org>
   Copyright 2011 James Morris <jwm.art.net@gmail.com>
 
-  Resampler function is taken from https://github.com/cpuimage/resampler/
-  Copyright (c) 2019 Zhihan Gao
-
   Permission to use, copy, modify, and/or distribute this software for any
   purpose with or without fee is hereby granted, provided that the above
   copyright notice and this permission notice appear in all copies.
@@ -25,7 +22,13 @@
 #include <string.h>
 #include <stdbool.h>
 #include <math.h>
-#include "fftw3.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
@@ -48,33 +51,172 @@
 #include "lv2/lv2plug.in/ns/lv2core/lv2.h"
 
 #include "./uris.h"
-#include "./circular_buffer.h"
+#include "./convolver.h"
+#include "./ir_loader.h"
+#include "./ir_index.h"
+#include "./default_ir.h"
+
+#define MAX_BLOCK_SIZE 2048
+
+// input history for preparing engines that continue where the old one is,
+// must hold twice the longest history an engine can need
+#define HISTORY_SIZE   65536
+
+// most blocks run() feeds a new engine to catch up, the worker primes it
+// until it is this close
+#define CATCH_UP_BLOCKS 4
+
+// share of a block period run() waits for the tail helper thread
+#define HELPER_DEADLINE 0.1
+
+// FFTW wisdom written by cabsim-wisdom, in the bundle or named by the environment
+#define WISDOM_FILE "cabsim.wisdom"
+#define WISDOM_ENV  "CABSIM_WISDOM"
+
+// unused IRs kept in memory with their kernels, for instances created later
+#define IR_CACHE_RETAIN 16
+
+// most IRs in a bank, and seconds of crossfade when selecting one
+#define BANK_MAX_SIZE  128
+#define BANK_FADE_TIME 0.02
 
-#define REAL 0
-#define IMAG 1
+// tuned partition layouts, below $XDG_CACHE_HOME or named by the environment
+#define LAYOUT_FILE "cabsim/layouts"
+#define LAYOUT_ENV  "CABSIM_LAYOUTS"
 
-#define MAX_FFT_SIZE 2048
+// index of the IR library, below $XDG_CACHE_HOME or named by the environment,
+// of the directories listed in the environment or the device's IR folder,
+// updated every INDEX_INTERVAL seconds
+#define INDEX_FILE     "cabsim/index"
+#define INDEX_ENV      "CABSIM_INDEX"
+#define INDEX_DIRS     "/data/user-files/Speaker Cabinet IRs"
+#define INDEX_DIRS_ENV "CABSIM_IR_DIRS"
+#define INDEX_INTERVAL 60
+
+// share of a block period the longest block of a tuned realtime layout may take
+#define TUNER_BUDGET 0.5
+
+// blocks a pass over the morph kernel is spread across, and least seconds
+// for a sweep of the whole morph range
+#define MORPH_CHUNKS 4
+#define MORPH_TIME   0.1
+
+// level meter updates sent to the notify port per second
+#define METER_RATE 30
 
 //macro for Volume in DB to a coefficient
 #define DB_CO(g) ((g) > -90.0f ? powf(10.0f, (g) * 0.05f) : 0.0f)
 
+//macro for a coefficient to a level in DB, down to -90
+#define CO_DB(c) ((c) > 3.1623e-5f ? 20.0f * log10f(c) : -90.0f)
+
 enum {
     CABSIM_CONTROL = 0,
     CABSIM_NOTIFY  = 1,
     CABSIM_IN      = 2,
     CABSIM_OUT     = 3,
-    ATTENUATE      = 4
+    ATTENUATE      = 4,
+    LATENCY_MODE   = 5,
+    LATENCY        = 6,
+    FREEWHEEL      = 7,
+    TAIL_THREAD    = 8,
+    IR_SELECT      = 9,
+    MORPH          = 10
+};
+
+enum {
+    MODE_ZERO_LATENCY = 0,
+    MODE_BLOCK_2X     = 1,
+    MODE_BLOCK_4X     = 2,
+    MODE_BLOCK_8X     = 3
 };
 
 //static const char* default_sample_file = "Orange_PPC412_V30_412_C_Hi-Gn_121+57_Celestion.wav";
 
-typedef struct {
-    SF_INFO  info;      // Info about sample from sndfile
-    float*   data;      // ImpulseResponse data in float
-    char*    path;      // Path of file
-    uint32_t path_len;  // Length of path
+// Kernel prepared from an IR for one engine layout
+typedef struct IRKernelT {
+    engine_layout_t   layout;
+    kernel_format_t   format;
+    kernel_t*         kernel;
+
+    struct IRKernelT* next;
+} IRKernel;
+
+typedef struct ImpulseResponseT {
+    SF_INFO          info;        // Info about sample from sndfile
+    float*           data;        // ImpulseResponse data in float
+    char*            path;        // Path of file
+    uint32_t         path_len;    // Length of path
+    int              samplerate;  // Rate the data was resampled to
+    bool             loading;     // Data is still being loaded by another thread
+    const DefaultIR* embedded;    // Compiled-in default IR the data points to
+    time_t           mtime;       // Modification time of the file when loaded
+    off_t            size;        // Size of the file when loaded
+    uint64_t         hash;        // Hash of the file from the index, if hashed
+    bool             hashed;      // The index knew the file when it was loaded
+    struct ImpulseResponseT* same; // IR of an identical file the data and kernels are shared with
+    uint32_t         refcount;    // Users in all instances, protected by ir_cache_lock
+    uint64_t         released;    // When the last user let go, protected by ir_cache_lock
+    IRKernel*        kernels;     // Kernels prepared so far, protected by ir_cache_lock
+
+    struct ImpulseResponseT* next;  // Next IR in ir_cache
 } ImpulseResponse;
 
+// IRs of all instances, so that instances loading the same file share a
+// single load and a single copy of the data and kernels.  IRs are per sample
+// rate, and the last IR_CACHE_RETAIN unused ones are kept, so instances
+// created again at another rate find theirs prepared.
+static pthread_mutex_t  ir_cache_lock   = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   ir_cache_loaded = PTHREAD_COND_INITIALIZER;
+static ImpulseResponse* ir_cache        = NULL;
+static uint64_t         ir_cache_clock  = 0;
+
+typedef struct {
+    ImpulseResponse** irs;       // IRs in bank order
+    uint32_t          count;     // Number of IRs
+    char*             path;      // Directory or list file
+    uint32_t          path_len;  // Length of path
+    uint32_t          refcount;  // Convolutions using it, only touched outside run()
+} Bank;
+
+/**
+   Partition layout chosen by the tuner for an engine configuration.
+
+   Realtime layouts must keep the cost of every block within the budget,
+   the others, for freewheeling or with the tail thread, only need the lowest
+   mean cost.
+*/
+typedef struct TunedLayoutT {
+    uint32_t samplerate;
+    uint32_t block_size;
+    uint32_t head_block_size;
+    uint32_t ir_len;
+    uint32_t realtime;
+    uint32_t tail_block_size;
+
+    struct TunedLayoutT* next;
+} TunedLayout;
+
+typedef struct {
+    ImpulseResponse* ir;          // IR the kernel was prepared from, NULL for a bank
+    const kernel_t*  kernel;      // IR spectra for the engine layout, owned by ir
+    ImpulseResponse* ir2;         // IR morphed to, NULL if not morphing
+    const kernel_t*  kernel2;     // IR spectra of ir2, owned by ir2
+    kernel_t*        morph_kernel; // Mix of both kernels used by the engine
+    float            morph;       // Amount of the pass over morph_kernel
+    size_t           morph_pos;   // Where the pass continues
+    size_t           morph_left;  // Complex values left in the pass
+    Bank*            bank;        // Bank the kernels were prepared from
+    kernel_bank_t*   kernels;     // IR spectra of all bank IRs
+    engine_t*        engine;      // NULL until the block size is known
+    engine_t*        fade_engine; // Bank engine that is faded out, or idle
+    uint32_t         index;       // Bank IR used by engine
+    uint32_t         fade_pos;    // Frames left until the crossfade ends
+    uint32_t         primed_pos;  // History position the engine has been fed up to
+    bool             primed;      // Engine state matches the input history
+    TunedLayout      layout;      // Configuration and layout of the engines
+} Convolution;
+
 typedef struct {
     // Features
     LV2_URID_Map*        map;
@@ -87,14 +229,38 @@ typedef struct {
     // Logger convenience API
     LV2_Log_Logger logger;
 
-    // ImpulseResponse
-    ImpulseResponse* ir;
+    // Convolution used by run()
+    Convolution* conv;
+
+    // Convolution restored without a worker, picked up by run()
+    Convolution* restored;
+
+    // Last loaded IR, second IR or bank and engine layout, owned by the worker
+    // and by restore() without a worker, which hold worker_lock to use them
+    pthread_mutex_t  worker_lock;
+    ImpulseResponse* worker_ir;
+    ImpulseResponse* worker_ir2;
+    Bank*            worker_bank;
+    uint32_t         worker_block_size;
+    uint32_t         worker_partition_multiplier;
+    bool             worker_freewheel;
+    bool             worker_helper;
+    int              worker_priority;
+
+    // Storage of the IR spectra, from the environment
+    kernel_format_t  kernel_format;
 
     // Ports
     const LV2_Atom_Sequence* control_port;
     LV2_Atom_Sequence*       notify_port;
     float*                   output_port;
     float*                   input_port;
+    const float*             latency_mode;
+    float*                   latency_port;
+    const float*             freewheel_port;
+    const float*             tail_thread_port;
+    const float*             ir_select_port;
+    const float*             morph_port;
 
     // Forge frame for notify port (for writing worker replies)
     LV2_Atom_Forge_Frame notify_frame;
@@ -109,144 +275,1447 @@ typedef struct {
     sf_count_t frame;
     bool       play;
     bool       new_ir;
-    bool       ir_loaded;
+    bool       new_layout;
 
     double samplerate;
 
+    // Path of the default IR in the bundle
+    char* default_ir_path;
+
     //CABSIM ========================================
 
-    float *outbuf;
-    float *inbuf;
-    float *IR;
+    float *inbuf;
+    float *scratch;
+
+    const float *attenuation;
+
+    // Engine layout last requested from the worker
+    uint32_t block_size;
+    uint32_t partition_multiplier;
+    bool     freewheel;
+    bool     helper;
+
+    // Engine input of the last HISTORY_SIZE frames, written by run() only
+    float*   history;
+    uint32_t history_pos;
+
+    // Bank IR selected by run(), and crossfade length
+    uint32_t bank_index;
+    uint32_t fade_length;
+
+    // Morph amount set by run(), new convolutions start there
+    float morph;
+
+    // Input and output levels since the last meter update, and frames per update
+    float    meter_in_peak;
+    float    meter_in_sum;
+    float    meter_out_peak;
+    float    meter_out_sum;
+    uint32_t meter_clips;
+    uint32_t meter_frames;
+    uint32_t meter_period;
+
+    // Bank loading status for the notify port
+    uint32_t bank_loaded;
+    uint32_t bank_size;
+    uint64_t bank_memory;
+    bool     bank_status;
+} Cabsim;
+
+typedef struct {
+    LV2_Atom atom;
+    Convolution* conv;
+} ConvolutionMessage;
+
+typedef struct {
+    LV2_Atom atom;
+    uint32_t loaded;
+    uint32_t total;
+    uint64_t memory;
+} BankProgressMessage;
+
+typedef struct {
+    LV2_Atom atom;
+    uint32_t block_size;
+    uint32_t partition_multiplier;
+    uint32_t freewheel;
+    uint32_t helper;
+    int32_t  priority;
+} ConfigureMessage;
+
+// Files of a restored state for the worker, followed by both paths
+typedef struct {
+    LV2_Atom atom;
+    LV2_URID key;        // cab_ir or cab_bank, or 0 if the state has neither
+    uint32_t path_len;
+    uint32_t path2_len;  // second ir, 0 to stop morphing
+} StateMessage;
+
+// Layouts tuned or restored by all instances, and read from the layout file
+// once per process
+static pthread_mutex_t tuned_lock    = PTHREAD_MUTEX_INITIALIZER;
+static TunedLayout*    tuned_layouts = NULL;
+static bool            tuned_read    = false;
+
+/**
+   Path of a cache file, @p file below the cache directory or the one named
+   by the environment variable @p env, or NULL.  Returns a newly allocated
+   string.
+*/
+static char*
+cache_file_path(const char* env, const char* file)
+{
+    const char* const configured = getenv(env);
+    if (configured) {
+        return *configured ? strdup(configured) : NULL;
+    }
+
+    const char* base   = getenv("XDG_CACHE_HOME");
+    const char* suffix = "";
+    if (!base || !*base) {
+        base   = getenv("HOME");
+        suffix = "/.cache";
+    }
+    if (!base || !*base) {
+        return NULL;
+    }
+
+    char* const path = (char*)malloc(strlen(base) + strlen(suffix) + strlen(file) + 2);
+    if (path) {
+        sprintf(path, "%s%s/%s", base, suffix, file);
+    }
+    return path;
+}
+
+// must be called with tuned_lock held
+static TunedLayout*
+find_tuned_layout(const TunedLayout* key)
+{
+    for (TunedLayout* tuned = tuned_layouts; tuned; tuned = tuned->next) {
+        if (tuned->samplerate == key->samplerate
+            && tuned->block_size == key->block_size
+            && tuned->head_block_size == key->head_block_size
+            && tuned->ir_len == key->ir_len
+            && tuned->realtime == key->realtime) {
+            return tuned;
+        }
+    }
+    return NULL;
+}
+
+/**
+   Remember a tuned layout, replacing an older result for the same
+   configuration.  Must be called with tuned_lock held.
+*/
+static bool
+add_tuned_layout(const TunedLayout* layout)
+{
+    // a tail that does not fit the IR would break the engine
+    if (!layout->block_size || layout->head_block_size % layout->block_size
+        || (layout->tail_block_size && (layout->tail_block_size < 2 * layout->head_block_size
+                                        || layout->tail_block_size % layout->head_block_size
+                                        || 2 * layout->tail_block_size >= layout->ir_len))) {
+        return false;
+    }
+
+    TunedLayout* tuned = find_tuned_layout(layout);
+    if (!tuned) {
+        tuned = (TunedLayout*)malloc(sizeof(TunedLayout));
+        if (!tuned) {
+            return false;
+        }
+        *tuned        = *layout;
+        tuned->next   = tuned_layouts;
+        tuned_layouts = tuned;
+    }
+    tuned->tail_block_size = layout->tail_block_size;
+    return true;
+}
+
+/**
+   Read the layout file, once per process.  Must be called with tuned_lock
+   held.
+*/
+static void
+read_tuned_layouts(void)
+{
+    if (tuned_read) {
+        return;
+    }
+    tuned_read = true;
+
+    char* const path = cache_file_path(LAYOUT_ENV, LAYOUT_FILE);
+    FILE* const file = path ? fopen(path, "r") : NULL;
+    free(path);
+    if (!file) {
+        return;
+    }
+
+    TunedLayout layout = { 0 };
+    while (fscanf(file, "%u %u %u %u %u %u", &layout.samplerate, &layout.block_size,
+                  &layout.head_block_size, &layout.ir_len, &layout.realtime,
+                  &layout.tail_block_size) == 6) {
+        // results measured in this process take precedence
+        if (!find_tuned_layout(&layout)) {
+            add_tuned_layout(&layout);
+        }
+    }
+    fclose(file);
+}
+
+/**
+   Write all tuned layouts to the layout file, replacing it at once so that
+   other processes never read a partial file.  Must be called with
+   tuned_lock held.
+*/
+static void
+write_tuned_layouts(Cabsim* self)
+{
+    char* const path = cache_file_path(LAYOUT_ENV, LAYOUT_FILE);
+    if (!path) {
+        return;
+    }
+
+    // create the cache directory, but not its parents
+    char* const slash = strrchr(path, '/');
+    if (slash && slash != path) {
+        *slash = 0;
+        mkdir(path, 0755);
+        *slash = '/';
+    }
+
+    char* const tmp = (char*)malloc(strlen(path) + 5);
+    if (!tmp) {
+        free(path);
+        return;
+    }
+    sprintf(tmp, "%s.tmp", path);
+
+    FILE* const file = fopen(tmp, "w");
+    bool        ok   = file != NULL;
+    if (file) {
+        for (const TunedLayout* tuned = tuned_layouts; tuned; tuned = tuned->next) {
+            fprintf(file, "%u %u %u %u %u %u\n", tuned->samplerate, tuned->block_size,
+                    tuned->head_block_size, tuned->ir_len, tuned->realtime,
+                    tuned->tail_block_size);
+        }
+        ok = fclose(file) == 0 && rename(tmp, path) == 0;
+    }
+
+    if (!ok) {
+        lv2_log_warning(&self->logger, "Failed to write tuned layouts to %s\n", path);
+        remove(tmp);
+    }
+    free(tmp);
+    free(path);
+}
+
+/**
+   Choose the tail of @p layout for the IR by timing the candidates on this
+   machine, the first time a configuration is used.  Later uses, in any
+   instance or process, get the same result.
+
+   Blocks while tuning, so it is called from the worker thread only.
+*/
+static void
+tune_layout(Cabsim* self, engine_layout_t* layout, const float* ir, uint32_t ir_len, bool realtime)
+{
+    const TunedLayout key = { (uint32_t)self->samplerate, layout->block_size,
+        layout->head_block_size, ir_len, realtime, 0, NULL };
+
+    pthread_mutex_lock(&tuned_lock);
+    read_tuned_layouts();
+    const TunedLayout* tuned = find_tuned_layout(&key);
+    if (tuned) {
+        layout->tail_block_size = tuned->tail_block_size;
+        pthread_mutex_unlock(&tuned_lock);
+        return;
+    }
+    pthread_mutex_unlock(&tuned_lock);
+
+    // concurrent instances may tune the same configuration, which is only
+    // wasted time
+    const double budget = realtime ? TUNER_BUDGET * layout->block_size / self->samplerate : INFINITY;
+    if (!engine_layout_tune(layout, ir, ir_len, budget)) {
+        return;
+    }
+
+    lv2_log_trace(&self->logger, "Tuned tail partitions of %u frames for %u frame blocks\n",
+            layout->tail_block_size, layout->block_size);
+
+    TunedLayout result = key;
+    result.tail_block_size = layout->tail_block_size;
+
+    pthread_mutex_lock(&tuned_lock);
+    if (add_tuned_layout(&result)) {
+        write_tuned_layouts(self);
+    }
+    pthread_mutex_unlock(&tuned_lock);
+}
+
+// Latest index of the IR library, replaced by the index thread, which runs
+// while any instance exists
+static pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  index_wake = PTHREAD_COND_INITIALIZER;
+static ir_index_t*     ir_library = NULL;
+static bool            index_stop = false;
+
+// Starting and stopping the index thread, held while joining it
+static pthread_mutex_t index_users_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t        index_users      = 0;
+static bool            index_running    = false;
+static pthread_t       index_thread;
+
+static const char*
+index_dirs(void)
+{
+    const char* const configured = getenv(INDEX_DIRS_ENV);
+    return configured ? configured : INDEX_DIRS;
+}
+
+/**
+   Make a copy of @p index the one load_ir() and bank listing look files up
+   in.
+*/
+static void
+publish_index(const ir_index_t* index)
+{
+    ir_index_t* const copy = ir_index_copy(index);
+    if (!copy) {
+        return;
+    }
+
+    pthread_mutex_lock(&index_lock);
+    ir_index_t* const old = ir_library;
+    ir_library = copy;
+    pthread_mutex_unlock(&index_lock);
+
+    ir_index_free(old);
+}
+
+/**
+   Keep the index of the IR library up to date: read the index file, then
+   update the index for the IR directories every INDEX_INTERVAL seconds,
+   writing it back when anything changed.  Only new and changed files are
+   read.
+*/
+static void*
+index_main(void* arg)
+{
+    char* const       path  = cache_file_path(INDEX_ENV, INDEX_FILE);
+    char* const       dirs  = strdup(index_dirs());
+    ir_index_t* const index = ir_index_new();
+
+    if (dirs && index) {
+        if (path) {
+            ir_index_read(index, path);
+        }
+        publish_index(index);
+
+        while (!__atomic_load_n(&index_stop, __ATOMIC_RELAXED)) {
+            uint32_t changed = 0;
+            for (const char* dir = dirs; *dir; ) {
+                const size_t len = strcspn(dir, ":");
+                char* const  one = strndup(dir, len);
+                if (one && *one) {
+                    changed += ir_index_update(index, one, &index_stop);
+                }
+                free(one);
+                dir += len + (dir[len] == ':');
+            }
+
+            if (changed) {
+                publish_index(index);
+                if (path) {
+                    ir_index_write(index, path);
+                }
+            }
+
+            pthread_mutex_lock(&index_lock);
+            if (!index_stop) {
+                struct timespec until;
+                clock_gettime(CLOCK_REALTIME, &until);
+                until.tv_sec += INDEX_INTERVAL;
+                pthread_cond_timedwait(&index_wake, &index_lock, &until);
+            }
+            pthread_mutex_unlock(&index_lock);
+        }
+    }
+
+    ir_index_free(index);
+    free(dirs);
+    free(path);
+    return NULL;
+}
+
+/**
+   Start the index thread with the first instance, unless there are no IR
+   directories to index.
+*/
+static void
+start_index(void)
+{
+    pthread_mutex_lock(&index_users_lock);
+    if (index_users++ == 0 && *index_dirs()) {
+        __atomic_store_n(&index_stop, false, __ATOMIC_RELAXED);
+        index_running = pthread_create(&index_thread, NULL, index_main, NULL) == 0;
+    }
+    pthread_mutex_unlock(&index_users_lock);
+}
+
+/**
+   Stop the index thread with the last instance, before the plugin can be
+   unloaded.  The last published index stays in use.
+*/
+static void
+stop_index(void)
+{
+    pthread_mutex_lock(&index_users_lock);
+    if (--index_users == 0 && index_running) {
+        pthread_mutex_lock(&index_lock);
+        __atomic_store_n(&index_stop, true, __ATOMIC_RELAXED);
+        pthread_cond_signal(&index_wake);
+        pthread_mutex_unlock(&index_lock);
+
+        pthread_join(index_thread, NULL);
+        index_running = false;
+    }
+    pthread_mutex_unlock(&index_users_lock);
+}
+
+/**
+   Copy the index entry of the file at @p path, without its path, if it is
+   up to date for the file status @p st.
+*/
+static bool
+library_lookup(const char* path, const struct stat* st, ir_index_entry_t* entry)
+{
+    pthread_mutex_lock(&index_lock);
+    const ir_index_entry_t* const found = ir_library ? ir_index_lookup(ir_library, path, st) : NULL;
+    if (found) {
+        *entry      = *found;
+        entry->path = NULL;
+    }
+    pthread_mutex_unlock(&index_lock);
+    return found != NULL;
+}
+
+/**
+   Whether the index found that the file at @p path, as it is now, can't be
+   read as audio.
+*/
+static bool
+library_unreadable(const char* path)
+{
+    struct stat      st;
+    ir_index_entry_t entry;
+    return !stat(path, &st) && library_lookup(path, &st, &entry) && !entry.channels;
+}
+
+static void free_ir(Cabsim* self, ImpulseResponse* ir);
+
+/**
+   The compiled-in default IR for @p path at @p samplerate, or NULL if the
+   path is not the default IR in the bundle or the rate was not prepared.
+*/
+static const DefaultIR*
+find_default_ir(Cabsim* self, const char* path, int samplerate)
+{
+#ifdef HAVE_DEFAULT_IR
+    if (self->default_ir_path && !strcmp(path, self->default_ir_path)) {
+        for (uint32_t i = 0; i < default_ir_count; i++) {
+            if (default_irs[i].samplerate == samplerate) {
+                return &default_irs[i];
+            }
+        }
+    }
+#endif
+    return NULL;
+}
+
+/**
+   Prepared kernel of a compiled-in IR for @p layout, or NULL.
+*/
+static const DefaultKernel*
+find_default_kernel(Cabsim* self, const ImpulseResponse* ir, const engine_layout_t* layout)
+{
+    if (!ir || !ir->embedded || self->kernel_format != KERNEL_FORMAT_FLOAT) {
+        return NULL;
+    }
+    for (uint32_t i = 0; i < ir->embedded->kernel_count; i++) {
+        const DefaultKernel* const kernel = &ir->embedded->kernels[i];
+        if (kernel->head_block_size == layout->head_block_size
+            && kernel->tail_block_size == layout->tail_block_size) {
+            return kernel;
+        }
+    }
+    return NULL;
+}
+
+// must be called with ir_cache_lock held
+static void
+unlink_ir(ImpulseResponse* ir)
+{
+    for (ImpulseResponse** link = &ir_cache; *link; link = &(*link)->next) {
+        if (*link == ir) {
+            *link = ir->next;
+            break;
+        }
+    }
+}
+
+static void
+destroy_ir(Cabsim* self, ImpulseResponse* ir)
+{
+    if (!ir) {
+        return;
+    }
+
+    lv2_log_trace(&self->logger, "Freeing %s\n", ir->path);
+    while (ir->kernels) {
+        IRKernel* const next = ir->kernels->next;
+        kernel_free(ir->kernels->kernel);
+        free(ir->kernels);
+        ir->kernels = next;
+    }
+    free(ir->path);
+    if (ir->same) {
+        free_ir(self, ir->same);
+    } else if (!ir->embedded) {
+        free(ir->data);
+    }
+    free(ir);
+}
+
+// the loaded IR of a file with the same contents as @p ir, must be called
+// with ir_cache_lock held
+static ImpulseResponse*
+find_identical_ir(const ImpulseResponse* ir)
+{
+    for (ImpulseResponse* other = ir_cache; other; other = other->next) {
+        if (other->hashed && other->hash == ir->hash && other->samplerate == ir->samplerate
+            && !other->same && !other->loading && other->data) {
+            return other;
+        }
+    }
+    return NULL;
+}
+
+// unlinks and returns the longest unused IR once more than IR_CACHE_RETAIN
+// are unused, must be called with ir_cache_lock held
+static ImpulseResponse*
+evict_unused_ir(void)
+{
+    ImpulseResponse* oldest = NULL;
+    uint32_t         unused = 0;
+    for (ImpulseResponse* ir = ir_cache; ir; ir = ir->next) {
+        if (ir->refcount == 0) {
+            ++unused;
+            if (!oldest || ir->released < oldest->released) {
+                oldest = ir;
+            }
+        }
+    }
+
+    if (unused <= IR_CACHE_RETAIN) {
+        return NULL;
+    }
+    unlink_ir(oldest);
+    return oldest;
+}
+
+/**
+   Load a new ir and return it.
+
+   Since this is of course not a real-time safe action, this is called in the
+   worker thread only.  The ir is loaded and returned only, plugin state is
+   not modified.  If any instance already has the file loaded, or is loading
+   it, that copy is shared instead, as is an unused copy kept from earlier if
+   the file did not change since.  With the index, files it found unreadable
+   fail without being opened, and files identical to one that is loaded
+   share its data and kernels.
+*/
+static ImpulseResponse*
+load_ir(Cabsim* self, const char* path, uint32_t path_len)
+{
+    char* irpath = (char*)malloc(path_len + 1);
+    if (!irpath) {
+        return NULL;
+    }
+    memcpy(irpath, path, path_len);
+    irpath[path_len] = 0;
+
+    const int samplerate = (int)self->samplerate;
+
+    struct stat      st;
+    ir_index_entry_t indexed = { 0 };
+    bool             known   = false;
+    if (stat(irpath, &st)) {
+        st.st_mtime = 0;
+        st.st_size  = 0;
+    } else {
+        known = library_lookup(irpath, &st, &indexed);
+    }
+
+    if (known && !indexed.channels) {
+        lv2_log_error(&self->logger, "Failed to open ir '%s'\n", irpath);
+        free(irpath);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&ir_cache_lock);
+
+    ImpulseResponse* ir;
+    for (ir = ir_cache; ir; ir = ir->next) {
+        if (ir->samplerate == samplerate && !strcmp(ir->path, irpath)) {
+            break;
+        }
+    }
+
+    // an unused copy of a file that changed since is loaded again
+    ImpulseResponse* stale = NULL;
+    if (ir && ir->refcount == 0 && (ir->mtime != st.st_mtime || ir->size != st.st_size)) {
+        unlink_ir(ir);
+        stale = ir;
+        ir    = NULL;
+    }
+
+    if (ir) {
+        const bool kept = ir->refcount++ == 0;
+        while (ir->loading) {
+            pthread_cond_wait(&ir_cache_loaded, &ir_cache_lock);
+        }
+        pthread_mutex_unlock(&ir_cache_lock);
+
+        lv2_log_trace(&self->logger, kept ? "Reusing ir %s\n" : "Sharing ir %s\n", irpath);
+        free(irpath);
+
+        if (!ir->data) {
+            // the other load failed, it has already been logged
+            free_ir(self, ir);
+            return NULL;
+        }
+        return ir;
+    }
+
+    ir = (ImpulseResponse*)calloc(1, sizeof(ImpulseResponse));
+    if (!ir) {
+        pthread_mutex_unlock(&ir_cache_lock);
+        destroy_ir(self, stale);
+        lv2_log_error(&self->logger, "Failed to allocate memory for ir\n");
+        free(irpath);
+        return NULL;
+    }
+
+    // Fill ir struct, others wait for the data until it is loaded
+    ir->path       = irpath;
+    ir->path_len   = path_len;
+    ir->samplerate = samplerate;
+    ir->mtime      = st.st_mtime;
+    ir->size       = st.st_size;
+    ir->hash       = indexed.hash;
+    ir->hashed     = known;
+    ir->loading    = true;
+    ir->refcount   = 1;
+
+    // an identical file that is loaded already lends its data
+    ImpulseResponse* const same = known ? find_identical_ir(ir) : NULL;
+    if (same) {
+        ++same->refcount;
+        ir->same     = same;
+        ir->info     = same->info;
+        ir->data     = same->data;
+        ir->embedded = same->embedded;
+        ir->loading  = false;
+    }
+
+    ir->next = ir_cache;
+    ir_cache = ir;
+
+    pthread_mutex_unlock(&ir_cache_lock);
+
+    destroy_ir(self, stale);
+
+    if (same) {
+        lv2_log_trace(&self->logger, "Sharing ir %s for identical %s\n", same->path, irpath);
+        return ir;
+    }
+
+    const DefaultIR* const embedded = find_default_ir(self, irpath, samplerate);
+
+    float* data;
+    if (embedded) {
+        lv2_log_trace(&self->logger, "Using compiled-in ir %s\n", irpath);
+        ir->embedded        = embedded;
+        ir->info.frames     = embedded->frames;
+        ir->info.samplerate = embedded->samplerate;
+        ir->info.channels   = 1;
+        data                = (float*)embedded->data;
+    } else {
+        lv2_log_trace(&self->logger, "Loading ir %s\n", irpath);
+        data = ir_load(irpath, samplerate, &ir->info);
+    }
+
+    pthread_mutex_lock(&ir_cache_lock);
+    ir->data    = data;
+    ir->loading = false;
+    if (!data) {
+        // do not hand out a failed load to later requests
+        unlink_ir(ir);
+    }
+    pthread_cond_broadcast(&ir_cache_loaded);
+    pthread_mutex_unlock(&ir_cache_lock);
+
+    if (!data) {
+        lv2_log_error(&self->logger, "Failed to open ir '%s'\n", irpath);
+        free_ir(self, ir);
+        return NULL;
+    }
+
+    return ir;
+}
+
+static void
+ref_ir(ImpulseResponse* ir)
+{
+    pthread_mutex_lock(&ir_cache_lock);
+    ++ir->refcount;
+    pthread_mutex_unlock(&ir_cache_lock);
+}
+
+/**
+   Drop a reference to @p ir.  Unused IRs stay in ir_cache until more than
+   IR_CACHE_RETAIN are unused, failed loads are freed.
+*/
+static void
+free_ir(Cabsim* self, ImpulseResponse* ir)
+{
+    if (!ir) {
+        return;
+    }
+
+    ImpulseResponse* evicted = NULL;
+
+    pthread_mutex_lock(&ir_cache_lock);
+    if (--ir->refcount == 0) {
+        if (ir->data) {
+            ir->released = ++ir_cache_clock;
+            evicted      = evict_unused_ir();
+        } else {
+            evicted = ir;
+        }
+    }
+    pthread_mutex_unlock(&ir_cache_lock);
+
+    destroy_ir(self, evicted);
+}
+
+static uint32_t
+ir_length(const ImpulseResponse* ir)
+{
+    return ir->info.frames < IR_MAX_LENGTH ? (uint32_t)ir->info.frames : IR_MAX_LENGTH;
+}
+
+// must be called with ir_cache_lock held
+static const kernel_t*
+find_ir_kernel(const ImpulseResponse* ir, const engine_layout_t* layout, kernel_format_t format)
+{
+    for (const IRKernel* entry = ir->kernels; entry; entry = entry->next) {
+        if (entry->format == format
+            && entry->layout.block_size == layout->block_size
+            && entry->layout.head_block_size == layout->head_block_size
+            && entry->layout.tail_block_size == layout->tail_block_size) {
+            return entry->kernel;
+        }
+    }
+    return NULL;
+}
+
+/**
+   Kernel of @p ir for @p layout, prepared once and kept with the IR, so
+   instances sharing the IR, and instances created later at the same rate,
+   skip the transforms.  A compiled-in IR uses its @p prepared spectra.
+*/
+static const kernel_t*
+ir_kernel(ImpulseResponse*       ir,
+          const engine_layout_t* layout,
+          kernel_format_t        format,
+          const DefaultKernel*   prepared)
+{
+    // identical files share their kernels too
+    if (ir->same) {
+        ir = ir->same;
+    }
+
+    pthread_mutex_lock(&ir_cache_lock);
+    const kernel_t* kernel = find_ir_kernel(ir, layout, format);
+    pthread_mutex_unlock(&ir_cache_lock);
+    if (kernel) {
+        return kernel;
+    }
+
+    IRKernel* entry = (IRKernel*)calloc(1, sizeof(IRKernel));
+    if (!entry) {
+        return NULL;
+    }
+    entry->layout = *layout;
+    entry->format = format;
+    entry->kernel = prepared
+        ? kernel_new_prepared(ir->data, ir_length(ir), layout, prepared->store, prepared->store_size)
+        : kernel_new(ir->data, ir_length(ir), layout, format);
+    if (!entry->kernel) {
+        free(entry);
+        return NULL;
+    }
+
+    // another instance may have prepared the same kernel meanwhile
+    pthread_mutex_lock(&ir_cache_lock);
+    kernel = find_ir_kernel(ir, layout, format);
+    if (!kernel) {
+        kernel      = entry->kernel;
+        entry->next = ir->kernels;
+        ir->kernels = entry;
+        entry       = NULL;
+    }
+    pthread_mutex_unlock(&ir_cache_lock);
+
+    if (entry) {
+        kernel_free(entry->kernel);
+        free(entry);
+    }
+    return kernel;
+}
+
+/**
+   Feed the input history to a new engine, so that once installed its output
+   continues seamlessly from the engine it replaces.
+
+   run() keeps writing the history while this reads the part before
+   history_pos, so the engine follows it until at most CATCH_UP_BLOCKS are
+   left for install_convolution().  That checks that the history was not
+   overwritten.
+*/
+static void
+prime_convolution(Cabsim* self, Convolution* conv, uint32_t ir_len)
+{
+    engine_t* const engine = conv->engine;
+    const uint32_t  end    = __atomic_load_n(&self->history_pos, __ATOMIC_ACQUIRE);
+    const uint32_t  length = engine_history_length(engine, ir_len);
+
+    conv->primed_pos = end;
+    conv->primed     = false;
+
+    if (length > HISTORY_SIZE / 2) {
+        return;
+    }
+
+    float* const discard = (float*)malloc(sizeof(float) * engine->block_size);
+    if (!discard) {
+        return;
+    }
+
+    const uint32_t block_size = engine->block_size;
+    uint32_t       pos        = end - length;
+    uint32_t       target     = end;
+    for (;;) {
+        for (; pos != target; pos += block_size) {
+            const float* const input = self->history + (pos & (HISTORY_SIZE - 1));
+            engine_process(engine, input, discard, block_size);
+            if (conv->fade_engine) {
+                engine_process(conv->fade_engine, input, discard, block_size);
+            }
+        }
+
+        // stay in whole blocks from the start, and give up if falling behind
+        const uint32_t behind = __atomic_load_n(&self->history_pos, __ATOMIC_ACQUIRE) - pos;
+        if (behind <= CATCH_UP_BLOCKS * block_size || behind > HISTORY_SIZE / 2) {
+            break;
+        }
+        target = pos + behind - behind % block_size;
+    }
+
+    free(discard);
+    conv->primed_pos = pos;
+    conv->primed     = true;
+}
+
+static void
+free_bank(Cabsim* self, Bank* bank)
+{
+    if (bank && --bank->refcount == 0) {
+        for (uint32_t i = 0; i < bank->count; i++) {
+            free_ir(self, bank->irs[i]);
+        }
+        free(bank->irs);
+        free(bank->path);
+        free(bank);
+    }
+}
+
+static uint32_t
+bank_length(const Bank* bank)
+{
+    uint32_t length = 0;
+    for (uint32_t i = 0; i < bank->count; i++) {
+        if (ir_length(bank->irs[i]) > length) {
+            length = ir_length(bank->irs[i]);
+        }
+    }
+    return length;
+}
+
+static void
+free_convolution(Cabsim* self, Convolution* conv)
+{
+    if (conv) {
+        if (conv->engine && engine_helper_misses(conv->engine)) {
+            lv2_log_trace(&self->logger, "Tail thread missed %u deadlines\n",
+                    engine_helper_misses(conv->engine));
+        }
+        engine_free(conv->engine);
+        engine_free(conv->fade_engine);
+        kernel_free(conv->morph_kernel);
+        kernel_bank_free(conv->kernels);
+        free_ir(self, conv->ir);
+        free_ir(self, conv->ir2);
+        free_bank(self, conv->bank);
+        free(conv);
+    }
+}
+
+/**
+   Prepare kernels for all IRs of a bank, the engine starts with the IR last
+   selected in run().
+*/
+static const kernel_t*
+prepare_bank_kernels(Cabsim* self, Convolution* conv, const engine_layout_t* layout)
+{
+    const Bank* const bank = conv->bank;
+
+    const float** irs  = (const float**)malloc(sizeof(float*) * bank->count);
+    uint32_t*     lens = (uint32_t*)malloc(sizeof(uint32_t) * bank->count);
+    if (irs && lens) {
+        for (uint32_t i = 0; i < bank->count; i++) {
+            irs[i]  = bank->irs[i]->data;
+            lens[i] = ir_length(bank->irs[i]);
+        }
+        conv->kernels = kernel_bank_new(irs, lens, bank->count, layout, self->kernel_format);
+    }
+    free(irs);
+    free(lens);
+
+    if (!conv->kernels) {
+        return NULL;
+    }
+
+    const uint32_t index = __atomic_load_n(&self->bank_index, __ATOMIC_RELAXED);
+    conv->index = index < bank->count ? index : bank->count - 1;
+    return &conv->kernels->kernels[conv->index];
+}
+
+/**
+   Prepare the float kernel of the second IR and the kernel the engine uses,
+   which starts at the morph amount last set in run().
+*/
+static const kernel_t*
+prepare_morph_kernels(Cabsim* self, Convolution* conv, const engine_layout_t* layout)
+{
+    conv->kernel2 = ir_kernel(conv->ir2, layout, KERNEL_FORMAT_FLOAT, NULL);
+    if (!conv->kernel || !conv->kernel2) {
+        return NULL;
+    }
+
+    conv->morph_kernel = kernel_new_morph(conv->kernel, conv->kernel2);
+    if (!conv->morph_kernel) {
+        return NULL;
+    }
+
+    __atomic_load(&self->morph, &conv->morph, __ATOMIC_RELAXED);
+    kernel_morph(conv->morph_kernel, conv->kernel, conv->kernel2, conv->morph, 0,
+            kernel_morph_length(conv->morph_kernel));
+    return conv->morph_kernel;
+}
+
+/**
+   Prepare a convolution engine for an IR, optionally morphed with a second
+   IR, or a bank and the layout last requested by run().
+
+   Like load_ir(), this allocates and plans FFTs, so it is called from the
+   worker thread only.
+*/
+static Convolution*
+new_convolution(Cabsim* self, ImpulseResponse* ir, ImpulseResponse* ir2, Bank* bank)
+{
+    Convolution* const conv = (Convolution*)calloc(1, sizeof(Convolution));
+    if (!conv) {
+        return NULL;
+    }
+
+    conv->ir   = ir;
+    conv->ir2  = bank ? NULL : ir2;
+    conv->bank = bank;
+
+    if (self->worker_block_size) {
+        uint32_t ir_len = bank ? bank_length(bank) : ir_length(ir);
+
+        // the tail is tuned for the longest IR of a bank or a morph
+        const float* tune_ir = ir ? ir->data : NULL;
+        for (uint32_t i = 0; bank && i < bank->count; i++) {
+            if (ir_length(bank->irs[i]) == ir_len) {
+                tune_ir = bank->irs[i]->data;
+            }
+        }
+        if (conv->ir2 && ir_length(conv->ir2) > ir_len) {
+            ir_len  = ir_length(conv->ir2);
+            tune_ir = conv->ir2->data;
+        }
+
+        const bool realtime = !self->worker_freewheel && !self->worker_helper;
+
+        engine_layout_t layout;
+        if (self->worker_freewheel) {
+            engine_layout_throughput(&layout, self->worker_block_size, self->worker_partition_multiplier, ir_len);
+        } else {
+            engine_layout_realtime(&layout, self->worker_block_size, self->worker_partition_multiplier, ir_len);
+        }
+        // the default IR keeps the layout it has prepared kernels for
+        const DefaultKernel* const prepared = find_default_kernel(self, ir, &layout);
+        if (!prepared) {
+            tune_layout(self, &layout, tune_ir, ir_len, realtime);
+        }
+
+        conv->layout = (TunedLayout){ (uint32_t)self->samplerate, layout.block_size,
+            layout.head_block_size, ir_len, realtime, layout.tail_block_size, NULL };
+
+        const kernel_t* kernel;
+        if (bank) {
+            // Bank IRs are selected by fading between two engines
+            kernel = prepare_bank_kernels(self, conv, &layout);
+            conv->fade_engine = engine_new(&layout, ir_len);
+        } else {
+            // morphing mixes float spectra
+            kernel = conv->kernel = ir_kernel(ir, &layout,
+                    conv->ir2 ? KERNEL_FORMAT_FLOAT : self->kernel_format, prepared);
+            if (conv->ir2) {
+                kernel = prepare_morph_kernels(self, conv, &layout);
+            }
+        }
+        conv->engine = engine_new(&layout, ir_len);
+
+        if (!kernel || !conv->engine || (bank && !conv->fade_engine)
+            || !engine_set_kernel(conv->engine, kernel)) {
+            lv2_log_error(&self->logger, "Failed to prepare engine for '%s'\n",
+                    bank ? bank->path : ir->path);
+            conv->ir   = NULL;
+            conv->ir2  = NULL;
+            conv->bank = NULL;
+            free_convolution(self, conv);
+            return NULL;
+        }
+
+        prime_convolution(self, conv, ir_len);
+
+        // offline rendering runs faster than the helper deadlines allow, and
+        // run() rewrites a morph kernel the helper would be reading
+        if (self->worker_helper && !self->worker_freewheel && layout.tail_block_size && !conv->ir2) {
+            const uint64_t deadline_ns = (uint64_t)(1e9 * HELPER_DEADLINE * self->worker_block_size / self->samplerate);
+            if (!engine_start_helper(conv->engine, self->worker_priority, deadline_ns)
+                || (conv->fade_engine && !engine_start_helper(conv->fade_engine, self->worker_priority, deadline_ns))) {
+                lv2_log_warning(&self->logger, "Failed to start tail thread, processing the tail in run()\n");
+            }
+        }
+    }
+
+    if (ir) {
+        ref_ir(ir);
+    }
+    if (conv->ir2) {
+        ref_ir(conv->ir2);
+    }
+    if (bank) {
+        ++bank->refcount;
+    }
+    return conv;
+}
+
+/**
+   Send a new convolution to run().
+*/
+static void
+respond_convolution(Cabsim*                     self,
+                    LV2_Worker_Respond_Function respond,
+                    LV2_Worker_Respond_Handle   handle,
+                    Convolution*                conv)
+{
+    if (conv) {
+        ConvolutionMessage msg = { { sizeof(Convolution*), self->uris.cab_applyImpulseResponse },
+            conv };
+        respond(handle, sizeof(msg), &msg);
+    }
+}
+
+/**
+   Make @p ir the IR that later engine layouts are prepared from.
+*/
+static void
+set_worker_ir(Cabsim* self, ImpulseResponse* ir)
+{
+    free_ir(self, self->worker_ir);
+    self->worker_ir = ir;
+}
+
+/**
+   Make @p ir the IR that later engines morph to, or stop morphing if it is
+   NULL.
+*/
+static void
+set_worker_ir2(Cabsim* self, ImpulseResponse* ir)
+{
+    free_ir(self, self->worker_ir2);
+    self->worker_ir2 = ir;
+}
+
+/**
+   Make @p bank the bank that later engine layouts are prepared from, or
+   leave bank mode if it is NULL.
+*/
+static void
+set_worker_bank(Cabsim* self, Bank* bank)
+{
+    free_bank(self, self->worker_bank);
+    self->worker_bank = bank;
+}
+
+/**
+   Load the ir at @p path and send a convolution for it to run().
+
+   If it is the ir already in use, a convolution is only sent when
+   @p ir2_changed.  Returns false if the ir could not be loaded.
+*/
+static bool
+apply_ir_file(Cabsim*                     self,
+              LV2_Worker_Respond_Function respond,
+              LV2_Worker_Respond_Handle   handle,
+              const char*                 path,
+              uint32_t                    path_len,
+              bool                        ir2_changed)
+{
+    if (!self->worker_bank && self->worker_ir && self->worker_ir->path_len == path_len
+        && !memcmp(self->worker_ir->path, path, path_len)) {
+        lv2_log_trace(&self->logger, "Ir %s already loaded\n", self->worker_ir->path);
+        if (ir2_changed) {
+            respond_convolution(self, respond, handle,
+                    new_convolution(self, self->worker_ir, self->worker_ir2, NULL));
+        }
+        return true;
+    }
+
+    // Load ir.
+    ImpulseResponse* ir = load_ir(self, path, path_len);
+    if (!ir) {
+        return false;
+    }
+
+    set_worker_ir(self, ir);
+    set_worker_bank(self, NULL);
+
+    // Loaded ir, send it to run() to be applied.
+    respond_convolution(self, respond, handle, new_convolution(self, ir, self->worker_ir2, NULL));
+    return true;
+}
+
+/**
+   Load the second ir at @p path for later engines to morph to, an empty path
+   stops morphing.  Sets @p changed if that is not the second ir in use
+   already.  Returns false if the ir could not be loaded.
+*/
+static bool
+load_ir2_file(Cabsim* self, const char* path, uint32_t path_len, bool* changed)
+{
+    while (path_len && !path[path_len - 1]) {
+        --path_len;
+    }
+
+    *changed = false;
+
+    ImpulseResponse* ir = NULL;
+    if (path_len) {
+        if (self->worker_ir2 && self->worker_ir2->path_len == path_len
+            && !memcmp(self->worker_ir2->path, path, path_len)) {
+            lv2_log_trace(&self->logger, "Ir %s already loaded\n", self->worker_ir2->path);
+            return true;
+        }
+
+        ir = load_ir(self, path, path_len);
+        if (!ir) {
+            return false;
+        }
+    } else if (!self->worker_ir2) {
+        return true;
+    }
+
+    set_worker_ir2(self, ir);
+    *changed = true;
+    return true;
+}
+
+/**
+   Load the second ir at @p path and send a convolution morphing to it to
+   run(), unless a bank is used.  An empty path stops morphing.  Returns
+   false if the ir could not be loaded.
+*/
+static bool
+apply_ir2_file(Cabsim*                     self,
+               LV2_Worker_Respond_Function respond,
+               LV2_Worker_Respond_Handle   handle,
+               const char*                 path,
+               uint32_t                    path_len)
+{
+    bool changed;
+    if (!load_ir2_file(self, path, path_len, &changed)) {
+        return false;
+    }
+
+    if (changed && !self->worker_bank && self->worker_ir) {
+        respond_convolution(self, respond, handle,
+                new_convolution(self, self->worker_ir, self->worker_ir2, NULL));
+    }
+    return true;
+}
+
+static int
+compare_names(const void* a, const void* b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/**
+   List the IR files of a bank, at most BANK_MAX_SIZE.
+
+   A bank is either a directory, whose audio files are used in name order, or
+   a list file with one IR path per line.  Empty lines and lines starting
+   with '#' are skipped, relative paths are relative to the list file.
+*/
+static uint32_t
+list_bank_files(Cabsim* self, const char* path, char** files)
+{
+    uint32_t count = 0;
+
+    struct stat st;
+    if (stat(path, &st)) {
+        lv2_log_error(&self->logger, "Bank %s not found\n", path);
+        return 0;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        DIR* dir = opendir(path);
+        if (!dir) {
+            lv2_log_error(&self->logger, "Failed to open bank %s\n", path);
+            return 0;
+        }
+
+        struct dirent* entry;
+        while ((entry = readdir(dir)) && count < BANK_MAX_SIZE) {
+            if (entry->d_name[0] == '.' || !ir_index_audio_file(entry->d_name)) {
+                continue;
+            }
+            files[count] = (char*)malloc(strlen(path) + strlen(entry->d_name) + 2);
+            if (files[count]) {
+                sprintf(files[count], "%s/%s", path, entry->d_name);
+                // skip what the index found unreadable instead of opening it
+                if (library_unreadable(files[count])) {
+                    free(files[count]);
+                } else {
+                    ++count;
+                }
+            }
+        }
+        closedir(dir);
+
+        qsort(files, count, sizeof(char*), compare_names);
+        return count;
+    }
 
-    uint32_t prev_buffer_size;
-    const float *attenuation;
-    uint32_t valid_IR_data_length;
+    FILE* list = fopen(path, "r");
+    if (!list) {
+        lv2_log_error(&self->logger, "Failed to open bank %s\n", path);
+        return 0;
+    }
 
-    fftwf_complex *outComplex;
-    fftwf_complex *IRout;
-    fftwf_complex *convolved;
+    const char* const slash   = strrchr(path, '/');
+    const size_t      dir_len = slash ? (size_t)(slash - path) + 1 : 0;
 
-    fftwf_plan fft;
-    fftwf_plan ifft;
-    fftwf_plan IRfft;
+    char line[4096];
+    while (fgets(line, sizeof(line), list) && count < BANK_MAX_SIZE) {
+        size_t len = strlen(line);
+        while (len && isspace((unsigned char)line[len - 1])) {
+            line[--len] = 0;
+        }
+        if (!len || line[0] == '#') {
+            continue;
+        }
 
-    int overlap_add_buffers;
-    ringbuffer_t overlap_buffer;
-} Cabsim;
+        const size_t prefix = line[0] == '/' ? 0 : dir_len;
+        files[count] = (char*)malloc(prefix + len + 1);
+        if (files[count]) {
+            memcpy(files[count], path, prefix);
+            memcpy(files[count] + prefix, line, len + 1);
+            ++count;
+        }
+    }
+    fclose(list);
 
-typedef struct {
-    LV2_Atom atom;
-    ImpulseResponse*  ir;
-} ImpulseResponseMessage;
+    return count;
+}
 
-static uint64_t
-Resample_f32(const float *input, float *output, int inSampleRate,
-        int outSampleRate, uint64_t inputSize, uint32_t channels)
+static void
+respond_bank_progress(Cabsim*                     self,
+                      LV2_Worker_Respond_Function respond,
+                      LV2_Worker_Respond_Handle   handle,
+                      uint32_t                    loaded,
+                      uint32_t                    total,
+                      uint64_t                    memory)
 {
-    if (input == NULL)
-        return 0;
-    uint64_t outputSize = inputSize * outSampleRate / inSampleRate;
-    if (output == NULL)
-        return outputSize;
-    double stepDist = ((double) inSampleRate / (double) outSampleRate);
-    const uint64_t fixedFraction = (1LL << 32);
-    const double normFixed = (1.0 / (1LL << 32));
-    uint64_t step = ((uint64_t) (stepDist * fixedFraction + 0.5));
-    uint64_t curOffset = 0;
-    for (uint32_t i = 0; i < outputSize; i += 1) {
-        for (uint32_t c = 0; c < channels; c += 1) {
-            *output++ = (float) (input[c] + (input[c + channels] - input[c]) * (
-                        (double) (curOffset >> 32) + ((curOffset & (fixedFraction - 1)) * normFixed)));
-        }
-        curOffset += step;
-        input += (curOffset >> 32) * channels;
-        curOffset &= (fixedFraction - 1);
-    }
-    return outputSize;
+    BankProgressMessage msg = { { sizeof(BankProgressMessage) - sizeof(LV2_Atom), self->uris.cab_bankProgress },
+        loaded, total, memory };
+    respond(handle, sizeof(msg), &msg);
 }
 
-static sf_count_t
-convert_to_mono(float *data, sf_count_t num_input_frames, uint32_t channels)
+/**
+   Send a convolution for the current bank to run(), along with the memory
+   it uses, which depends on the engine layout.
+*/
+static void
+respond_bank(Cabsim*                     self,
+             LV2_Worker_Respond_Function respond,
+             LV2_Worker_Respond_Handle   handle)
 {
-    sf_count_t mono_index = 0;
-    for (sf_count_t i = 0; i < num_input_frames * channels; i+=channels) {
-        data[mono_index++] = data[i];
-    }
+    const Bank* const  bank = self->worker_bank;
+    Convolution* const conv = new_convolution(self, NULL, NULL, self->worker_bank);
 
-    sf_count_t num_output_frames = mono_index;
+    uint64_t memory = conv && conv->kernels ? conv->kernels->store_size : 0;
+    for (uint32_t i = 0; i < bank->count; i++) {
+        memory += sizeof(float) * ir_length(bank->irs[i]);
+    }
 
-    return num_output_frames;
+    respond_convolution(self, respond, handle, conv);
+    respond_bank_progress(self, respond, handle, bank->count, bank->count, memory);
 }
 
 /**
-   Load a new ir and return it.
-
-   Since this is of course not a real-time safe action, this is called in the
-   worker thread only.  The ir is loaded and returned only, plugin state is
-   not modified.
+   Load all IRs of a bank, and prepare their kernels so run() can switch
+   between them without the worker.  An empty path leaves bank mode.  Returns
+   false if no IR of the bank could be loaded.
 */
-static ImpulseResponse*
-load_ir(Cabsim* self, const char* path, uint32_t path_len)
+static bool
+apply_bank_file(Cabsim*                     self,
+                LV2_Worker_Respond_Function respond,
+                LV2_Worker_Respond_Handle   handle,
+                const char*                 path,
+                uint32_t                    path_len)
 {
-    char* irpath = (char*)malloc(path_len + 1);
-    memcpy(irpath, path, path_len);
-    irpath[path_len] = 0;
-
-    lv2_log_trace(&self->logger, "Loading ir %s\n", irpath);
+    while (path_len && !path[path_len - 1]) {
+        --path_len;
+    }
 
-    ImpulseResponse* const  ir  = (ImpulseResponse*)calloc(1, sizeof(ImpulseResponse));
-    SF_INFO* const info    = &ir->info;
-    SNDFILE* const sndfile = sf_open(irpath, SFM_READ, info);
+    if (!path_len) {
+        if (self->worker_bank) {
+            set_worker_bank(self, NULL);
+            if (self->worker_ir) {
+                respond_convolution(self, respond, handle, new_convolution(self, self->worker_ir, self->worker_ir2, NULL));
+            }
+            respond_bank_progress(self, respond, handle, 0, 0, 0);
+        }
+        return true;
+    }
 
-    if (!sndfile || !info->frames) {
-        lv2_log_error(&self->logger, "Failed to open ir '%s'\n", irpath);
-        free(ir);
-        return NULL;
+    if (self->worker_bank && self->worker_bank->path_len == path_len
+        && !memcmp(self->worker_bank->path, path, path_len)) {
+        lv2_log_trace(&self->logger, "Bank %s already loaded\n", self->worker_bank->path);
+        return true;
     }
 
-    // Read data
-    float* const data = malloc(sizeof(float) * (info->frames * info->channels));
-    if (!data) {
-        lv2_log_error(&self->logger, "Failed to allocate memory for ir\n");
-        return NULL;
+    Bank*  bank  = (Bank*)calloc(1, sizeof(Bank));
+    char** files = (char**)calloc(BANK_MAX_SIZE, sizeof(char*));
+    if (bank) {
+        bank->irs  = (ImpulseResponse**)calloc(BANK_MAX_SIZE, sizeof(ImpulseResponse*));
+        bank->path = (char*)malloc(path_len + 1);
+    }
+    if (!bank || !files || !bank->irs || !bank->path) {
+        if (bank) {
+            free(bank->irs);
+            free(bank->path);
+        }
+        free(bank);
+        free(files);
+        return false;
     }
-    sf_seek(sndfile, 0ul, SEEK_SET);
-    sf_read_float(sndfile, data, info->frames * info->channels);
-    sf_close(sndfile);
+    memcpy(bank->path, path, path_len);
+    bank->path[path_len] = 0;
+    bank->path_len = path_len;
+    bank->refcount = 1;
 
-    //When IR has multiple channels, only use first channel
-    if (info->channels != 1) {
-        info->frames = convert_to_mono(data, info->frames, info->channels);
-        info->channels = 1;
+    const uint32_t total = list_bank_files(self, bank->path, files);
+
+    // Report progress after every file, loading a large bank takes a while
+    uint64_t memory = 0;
+    for (uint32_t i = 0; i < total; i++) {
+        ImpulseResponse* const ir = load_ir(self, files[i], (uint32_t)strlen(files[i]));
+        if (ir) {
+            bank->irs[bank->count++] = ir;
+            memory += sizeof(float) * ir_length(ir);
+        }
+        free(files[i]);
+        respond_bank_progress(self, respond, handle, i + 1, total, memory);
     }
+    free(files);
 
-    //apply samplerate conversion if needed
-    if (info->samplerate == (int)self->samplerate) {
-        ir->data = data;
-    } else {
-        uint64_t targetSampleCount = Resample_f32(data, 0, info->samplerate, (int)self->samplerate, (uint64_t)info->frames, 1);
-        float* const resampled_data = malloc(targetSampleCount * sizeof(float));
-        info->frames = Resample_f32(data, resampled_data, info->samplerate, (int)self->samplerate, (uint64_t)info->frames, 1);
-        free(data);
-        ir->data = resampled_data;
+    if (!bank->count) {
+        lv2_log_error(&self->logger, "Bank %s has no usable IRs\n", bank->path);
+        free_bank(self, bank);
+        return false;
     }
 
-    // Fill ir struct and return it
-    ir->path     = irpath;
-    ir->path_len = path_len;
-    return ir;
+    lv2_log_trace(&self->logger, "Loaded %u IRs from bank %s\n", bank->count, bank->path);
+    set_worker_bank(self, bank);
+    respond_bank(self, respond, handle);
+    return true;
 }
 
-static void
-free_ir(Cabsim* self, ImpulseResponse* ir)
+/**
+   Apply the files of a restored state: the second ir at @p path2, then the
+   ir or bank at @p path as @p key says.  At most one convolution is sent to
+   run(), so the old one keeps playing until the restored one is ready.
+   Returns false if the ir or bank could not be loaded.
+*/
+static bool
+apply_state_files(Cabsim*                     self,
+                  LV2_Worker_Respond_Function respond,
+                  LV2_Worker_Respond_Handle   handle,
+                  LV2_URID                    key,
+                  const char*                 path,
+                  uint32_t                    path_len,
+                  const char*                 path2,
+                  uint32_t                    path2_len)
 {
-    if (ir) {
-        lv2_log_trace(&self->logger, "Freeing %s\n", ir->path);
-        free(ir->path);
-        free(ir->data);
-        free(ir);
+    bool ir2_changed = false;
+    if (!load_ir2_file(self, path2, path2_len, &ir2_changed)) {
+        lv2_log_error(&self->logger, "File %.*s couldn't be loaded\n", (int)path2_len, path2);
+    }
+
+    if (key == self->uris.cab_bank) {
+        // a bank does not morph
+        return apply_bank_file(self, respond, handle, path, path_len);
+    } else if (key == self->uris.cab_ir) {
+        return apply_ir_file(self, respond, handle, path, path_len, ir2_changed);
+    }
+
+    // only the second ir, if anything, changed
+    if (ir2_changed && !self->worker_bank && self->worker_ir) {
+        respond_convolution(self, respond, handle,
+                new_convolution(self, self->worker_ir, self->worker_ir2, NULL));
     }
+    return true;
 }
 
 /**
@@ -257,39 +1726,137 @@ free_ir(Cabsim* self, ImpulseResponse* ir)
    thread using the provided respond function.
 */
 static LV2_Worker_Status
-work(LV2_Handle                  instance,
-     LV2_Worker_Respond_Function respond,
-     LV2_Worker_Respond_Handle   handle,
-     uint32_t                    size,
-     const void*                 data)
+handle_work(Cabsim*                     self,
+            LV2_Worker_Respond_Function respond,
+            LV2_Worker_Respond_Handle   handle,
+            const void*                 data)
 {
-    Cabsim*        self = (Cabsim*)instance;
     const LV2_Atom* atom = (const LV2_Atom*)data;
-    if (atom->type == self->uris.cab_freeImpulseResponse) {
-        // Free old ir
-        const ImpulseResponseMessage* msg = (const ImpulseResponseMessage*)data;
-        free_ir(self, msg->ir);
+    if (atom->type == self->uris.cab_freeConvolution) {
+        // Free old convolution
+        const ConvolutionMessage* msg = (const ConvolutionMessage*)data;
+        free_convolution(self, msg->conv);
+    } else if (atom->type == self->uris.cab_configureEngine) {
+        // Block size or latency mode changed, rebuild the engine
+        const ConfigureMessage* msg = (const ConfigureMessage*)data;
+        self->worker_block_size           = msg->block_size;
+        self->worker_partition_multiplier = msg->partition_multiplier;
+        self->worker_freewheel            = msg->freewheel;
+        self->worker_helper               = msg->helper;
+        self->worker_priority             = msg->priority;
+
+        if (self->worker_bank) {
+            respond_bank(self, respond, handle);
+        } else if (self->worker_ir) {
+            respond_convolution(self, respond, handle, new_convolution(self, self->worker_ir, self->worker_ir2, NULL));
+        }
+    } else if (atom->type == self->uris.cab_restoreState) {
+        // State restored through the worker
+        const StateMessage* msg  = (const StateMessage*)data;
+        const char* const   path = (const char*)(msg + 1);
+        if (!apply_state_files(self, respond, handle, msg->key, path, msg->path_len,
+                               path + msg->path_len, msg->path2_len)) {
+            lv2_log_error(&self->logger, "File %.*s couldn't be loaded\n", (int)msg->path_len, path);
+        }
     } else {
-        // Handle set message (load ir).
+        // Handle set message (load ir or bank).
         const LV2_Atom_Object* obj = (const LV2_Atom_Object*)data;
 
         // Get file path from message
-        const LV2_Atom* file_path = read_set_file(&self->uris, obj);
+        LV2_URID        key;
+        const LV2_Atom* file_path = read_set_file(&self->uris, obj, &key);
         if (!file_path) {
             return LV2_WORKER_ERR_UNKNOWN;
         }
 
-        // Load ir.
-        ImpulseResponse* ir = load_ir(self, LV2_ATOM_BODY_CONST(file_path), file_path->size);
-        if (ir) {
-            // Loaded ir, send it to run() to be applied.
-            respond(handle, sizeof(ir), &ir);
+        if (key == self->uris.cab_bank) {
+            apply_bank_file(self, respond, handle, LV2_ATOM_BODY_CONST(file_path), file_path->size);
+        } else if (key == self->uris.cab_ir2) {
+            apply_ir2_file(self, respond, handle, LV2_ATOM_BODY_CONST(file_path), file_path->size);
+        } else {
+            apply_ir_file(self, respond, handle, LV2_ATOM_BODY_CONST(file_path), file_path->size, false);
         }
     }
 
     return LV2_WORKER_SUCCESS;
 }
 
+static LV2_Worker_Status
+work(LV2_Handle                  instance,
+     LV2_Worker_Respond_Function respond,
+     LV2_Worker_Respond_Handle   handle,
+     uint32_t                    size,
+     const void*                 data)
+{
+    Cabsim* self = (Cabsim*)instance;
+
+    // restore() without a worker may be loading at the same time
+    pthread_mutex_lock(&self->worker_lock);
+    const LV2_Worker_Status status = handle_work(self, respond, handle, data);
+    pthread_mutex_unlock(&self->worker_lock);
+
+    return status;
+}
+
+/**
+   Replace the convolution used by run(), in the audio thread.
+*/
+static void
+install_convolution(Cabsim* self, Convolution* conv)
+{
+    Convolution* const old_conv = self->conv;
+
+    // Install the new convolution
+    self->conv = conv;
+
+    // Feed what run() processed since the engine was primed, or start over
+    // if the history it was primed from is gone
+    engine_t* const engine = self->conv->engine;
+    engine_t* const fade   = self->conv->fade_engine;
+    if (engine) {
+        const uint32_t behind = self->history_pos - self->conv->primed_pos;
+        if (self->conv->primed && behind <= CATCH_UP_BLOCKS * engine->block_size
+            && behind % engine->block_size == 0) {
+            for (uint32_t pos = self->conv->primed_pos; pos != self->history_pos; pos += engine->block_size) {
+                const float* const input = self->history + (pos & (HISTORY_SIZE - 1));
+                engine_process(engine, input, self->scratch, engine->block_size);
+                if (fade) {
+                    engine_process(fade, input, self->scratch, engine->block_size);
+                }
+            }
+        } else {
+            engine_reset(engine);
+            if (fade) {
+                engine_reset(fade);
+            }
+        }
+
+        // the tail thread only takes over once the engine has caught up, it
+        // could not keep up with blocks processed back to back
+        engine_attach_helper(engine);
+        if (fade) {
+            engine_attach_helper(fade);
+        }
+    }
+
+    // Only tell the GUI when an ir or the bank changed, not for a new engine layout
+    if (!old_conv || old_conv->ir != self->conv->ir || old_conv->ir2 != self->conv->ir2
+        || old_conv->bank != self->conv->bank) {
+        self->new_ir = true;
+    }
+    if (engine && (!old_conv || !old_conv->engine
+                   || old_conv->engine->tail_block_size != engine->tail_block_size)) {
+        self->new_layout = true;
+    }
+
+    if (old_conv) {
+        // Send a message to the worker to free the current convolution
+        ConvolutionMessage msg = { { sizeof(Convolution*), self->uris.cab_freeConvolution },
+            old_conv };
+        self->schedule->schedule_work(self->schedule->handle, sizeof(msg), &msg);
+    }
+}
+
 /**
    Handle a response from work() in the audio thread.
 
@@ -302,19 +1869,17 @@ work_response(LV2_Handle  instance,
               uint32_t    size,
               const void* data)
 {
-    Cabsim* self = (Cabsim*)instance;
-
-    ImpulseResponseMessage msg = { { sizeof(ImpulseResponse*), self->uris.cab_freeImpulseResponse },
-        self->ir };
-
-    // Send a message to the worker to free the current ir
-    self->schedule->schedule_work(self->schedule->handle, sizeof(msg), &msg);
-
-    // Install the new ir
-    self->ir = *(ImpulseResponse*const*)data;
-
-    self->new_ir = true;
-    self->ir_loaded = false;
+    Cabsim*         self = (Cabsim*)instance;
+    const LV2_Atom* atom = (const LV2_Atom*)data;
+    if (atom->type == self->uris.cab_bankProgress) {
+        const BankProgressMessage* msg = (const BankProgressMessage*)data;
+        self->bank_loaded = msg->loaded;
+        self->bank_size   = msg->total;
+        self->bank_memory = msg->memory;
+        self->bank_status = true;
+    } else {
+        install_convolution(self, ((const ConvolutionMessage*)data)->conv);
+    }
 
     return LV2_WORKER_SUCCESS;
 }
@@ -341,11 +1906,69 @@ connect_port(LV2_Handle instance,
         case ATTENUATE:
             self->attenuation = (const float*) data;
             break;
+        case LATENCY_MODE:
+            self->latency_mode = (const float*) data;
+            break;
+        case LATENCY:
+            self->latency_port = (float*) data;
+            break;
+        case FREEWHEEL:
+            self->freewheel_port = (const float*) data;
+            break;
+        case TAIL_THREAD:
+            self->tail_thread_port = (const float*) data;
+            break;
+        case IR_SELECT:
+            self->ir_select_port = (const float*) data;
+            break;
+        case MORPH:
+            self->morph_port = (const float*) data;
+            break;
         default:
             break;
     }
 }
 
+/**
+   Import FFTW wisdom from the file named by CABSIM_WISDOM, the bundle and
+   the system.  Each is only read by the first instance in the process.
+*/
+static void
+import_wisdom(Cabsim* self, const char* bundle_path)
+{
+    bool imported = false;
+
+    const char* const configured = getenv(WISDOM_ENV);
+    if (configured && *configured) {
+        if (convolver_import_wisdom(configured)) {
+            imported = true;
+        } else {
+            lv2_log_warning(&self->logger, "failed to import wisdom file %s\n", configured);
+        }
+    }
+
+    char* const bundled = (char*)malloc(strlen(bundle_path) + strlen(WISDOM_FILE) + 2);
+    if (bundled) {
+        const size_t len = strlen(bundle_path);
+        sprintf(bundled, "%s%s%s", bundle_path,
+                len && bundle_path[len - 1] == '/' ? "" : "/", WISDOM_FILE);
+        if (convolver_import_wisdom(bundled)) {
+            lv2_log_trace(&self->logger, "wisdom file %s loaded\n", bundled);
+            imported = true;
+        }
+        free(bundled);
+    }
+
+    if (convolver_import_system_wisdom()) {
+        lv2_log_trace(&self->logger, "wisdom file loaded from system\n");
+        imported = true;
+    }
+
+    if (!imported && fft_backend_available(FFT_BACKEND_FFTW, 2)) {
+        lv2_log_warning(&self->logger, "no wisdom file found, using estimated FFTW plans\n");
+    }
+}
+
 static LV2_Handle
 instantiate(const LV2_Descriptor*     descriptor,
             double                    rate,
@@ -382,32 +2005,51 @@ instantiate(const LV2_Descriptor*     descriptor,
     lv2_atom_forge_init(&self->forge, self->map);
     lv2_log_logger_init(&self->logger, self->map, self->log);
 
-    self->outComplex = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex)*(MAX_FFT_SIZE));
-    self->IRout =  (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex)*(MAX_FFT_SIZE));
-    self->convolved =  (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex)*(MAX_FFT_SIZE));
-    self->outbuf = (float *) calloc((MAX_FFT_SIZE),sizeof(float));
-    self->inbuf = (float *) calloc((MAX_FFT_SIZE),sizeof(float));
-    self->IR = (float *) calloc((MAX_FFT_SIZE),sizeof(float));
+    self->inbuf = (float *) calloc((MAX_BLOCK_SIZE),sizeof(float));
+    self->scratch = (float *) calloc((MAX_BLOCK_SIZE),sizeof(float));
+    self->history = (float *) calloc((HISTORY_SIZE),sizeof(float));
+    if (!self->inbuf || !self->scratch || !self->history) {
+        free(self->inbuf);
+        free(self->scratch);
+        free(self->history);
+        goto fail;
+    }
+
+    pthread_mutex_init(&self->worker_lock, NULL);
+    import_wisdom(self, path);
+    start_index();
 
-    if (fftwf_import_system_wisdom() != 0)
-    {
-        self->fft = fftwf_plan_dft_r2c_1d(MAX_FFT_SIZE, self->inbuf, self->outComplex, FFTW_WISDOM_ONLY|FFTW_ESTIMATE);
-        self->IRfft = fftwf_plan_dft_r2c_1d(MAX_FFT_SIZE, self->IR, self->IRout, FFTW_WISDOM_ONLY|FFTW_ESTIMATE);
-        self->ifft = fftwf_plan_dft_c2r_1d(MAX_FFT_SIZE, self->convolved, self->outbuf, FFTW_WISDOM_ONLY|FFTW_ESTIMATE);
-        lv2_log_note(&self->logger, "wisdom file loaded from system\n");
-    } else {
-        self->fft = fftwf_plan_dft_r2c_1d(MAX_FFT_SIZE, self->inbuf, self->outComplex, FFTW_ESTIMATE);
-        self->IRfft = fftwf_plan_dft_r2c_1d(MAX_FFT_SIZE, self->IR, self->IRout, FFTW_ESTIMATE);
-        self->ifft = fftwf_plan_dft_c2r_1d(MAX_FFT_SIZE, self->convolved, self->outbuf, FFTW_ESTIMATE);
-        lv2_log_warning(&self->logger, "failed to import system wisdom file\n");
+    const size_t path_len = strlen(path);
+    self->default_ir_path = (char*)malloc(path_len + strlen(DEFAULT_IR_FILE) + 2);
+    if (self->default_ir_path) {
+        sprintf(self->default_ir_path, "%s%s%s", path,
+                path_len && path[path_len - 1] == '/' ? "" : "/", DEFAULT_IR_FILE);
     }
 
-    self->new_ir = false;
-    self->ir_loaded = false;
-    self->prev_buffer_size = UINT32_MAX;
+    self->kernel_format = KERNEL_FORMAT_FLOAT;
+    const char* const format = getenv(KERNEL_FORMAT_ENV);
+    if (format && *format && !kernel_format_parse(format, &self->kernel_format)) {
+        lv2_log_warning(&self->logger, "Unknown kernel format '%s', using float\n", format);
+    }
 
-    for (int i = 0; i < MAX_FFT_SIZE; i++)
-        self->inbuf[i] = 0.0f;
+    self->new_ir = false;
+    self->new_layout = false;
+
+    // The engine is prepared once run() tells the worker the block size
+    self->block_size = 0;
+    self->partition_multiplier = 1;
+    self->freewheel = false;
+    self->helper = false;
+    self->worker_block_size = 0;
+    self->worker_partition_multiplier = 1;
+    self->worker_freewheel = false;
+    self->worker_helper = false;
+    self->worker_priority = 0;
+    self->history_pos = 0;
+    self->bank_index = 0;
+    self->fade_length = (uint32_t)(rate * BANK_FADE_TIME);
+    self->morph = 0.0f;
+    self->meter_period = (uint32_t)(rate / METER_RATE);
 
     return (LV2_Handle)self;
 
@@ -416,21 +2058,64 @@ fail:
     return 0;
 }
 
+/**
+   Clear the input history, the state of the engines and the meters,
+   without reallocating, so processing starts again from silence.
+*/
+static void
+reset_processing(Cabsim* self)
+{
+    memset(self->history, 0, sizeof(float) * HISTORY_SIZE);
+
+    // engines the worker primed from the old history start over when installed
+    __atomic_store_n(&self->history_pos, self->history_pos + HISTORY_SIZE, __ATOMIC_RELEASE);
+
+    self->meter_in_peak  = 0.0f;
+    self->meter_in_sum   = 0.0f;
+    self->meter_out_peak = 0.0f;
+    self->meter_out_sum  = 0.0f;
+    self->meter_clips    = 0;
+    self->meter_frames   = 0;
+
+    Convolution* const conv = self->conv;
+    if (conv && conv->engine) {
+        engine_reset(conv->engine);
+        if (conv->fade_engine) {
+            engine_reset(conv->fade_engine);
+            engine_set_kernel(conv->fade_engine, NULL);
+            conv->fade_pos = 0;
+        }
+    }
+}
+
+static void
+activate(LV2_Handle instance)
+{
+    reset_processing((Cabsim*)instance);
+}
+
+static void
+deactivate(LV2_Handle instance)
+{
+    reset_processing((Cabsim*)instance);
+}
+
 static void
 cleanup(LV2_Handle instance)
 {
     Cabsim* self = (Cabsim*)instance;
 
-    fftwf_destroy_plan(self->fft);
-    fftwf_destroy_plan(self->IRfft);
-    fftwf_destroy_plan(self->ifft);
-    fftwf_free(self->outComplex);
-    fftwf_free(self->IRout);
-    fftwf_free(self->convolved);
-    free(self->outbuf);
+    stop_index();
     free(self->inbuf);
-    free(self->IR);
-    free_ir(self, self->ir);
+    free(self->scratch);
+    free(self->history);
+    free(self->default_ir_path);
+    free_convolution(self, self->conv);
+    free_convolution(self, self->restored);
+    free_ir(self, self->worker_ir);
+    free_ir(self, self->worker_ir2);
+    free_bank(self, self->worker_bank);
+    pthread_mutex_destroy(&self->worker_lock);
     free(self);
 }
 
@@ -446,11 +2131,9 @@ run(LV2_Handle instance,
     float*      input  = self->input_port;
     float*      output = self->output_port;
 
-    float *outbuf  = self->outbuf;
     float *inbuf   = self->inbuf;
-    float *IR      = self->IR;
 
-    if (n_frames > MAX_FFT_SIZE) {
+    if (n_frames > MAX_BLOCK_SIZE) {
         // unsupported
         memset(output, 0, sizeof(float)*n_frames);
         return;
@@ -489,8 +2172,8 @@ run(LV2_Handle instance,
                 }
 
                 const uint32_t key = ((const LV2_Atom_URID*)property)->body;
-                if (key == uris->cab_ir) {
-                    // ImpulseResponse change, send it to the worker.
+                if (key == uris->cab_ir || key == uris->cab_ir2 || key == uris->cab_bank) {
+                    // ImpulseResponse or bank change, send it to the worker.
                     lv2_log_trace(&self->logger, "Queueing set message\n");
                     self->schedule->schedule_work(self->schedule->handle,
                             lv2_atom_total_size(&ev->body),
@@ -512,95 +2195,229 @@ run(LV2_Handle instance,
 
     const float coef = DB_CO(attenuation);
 
-    uint32_t i, j, m;
+    uint32_t i;
+
+    uint32_t partition_multiplier = 1;
+    switch (self->latency_mode ? (int)(*self->latency_mode + 0.5f) : MODE_ZERO_LATENCY) {
+        case MODE_BLOCK_2X:
+            partition_multiplier = 2;
+        break;
+        case MODE_BLOCK_4X:
+            partition_multiplier = 4;
+        break;
+        case MODE_BLOCK_8X:
+            partition_multiplier = 8;
+        break;
+        default:
+            partition_multiplier = 1;
+        break;
+    }
 
-    if (n_frames != self->prev_buffer_size) {
-        switch (n_frames) {
-            case 64:
-                self->overlap_add_buffers = 32;
-            break;
-            case 128:
-                self->overlap_add_buffers = 16;
-            break;
-            case 256:
-                self->overlap_add_buffers = 8;
-            break;
-            case 512:
-                self->overlap_add_buffers = 4;
-            break;
-            default:
-                lv2_log_warning(&self->logger, "Non standard buffer size: '%i'. alliasing may happen\n", n_frames);
+    // Offline rendering gets the engine with the best throughput for the same latency
+    const bool freewheel = self->freewheel_port && *self->freewheel_port > 0.5f;
 
-                self->overlap_add_buffers = 16;
-            break;
+    // Long tails can be moved to a helper thread
+    const bool helper = self->tail_thread_port && *self->tail_thread_port > 0.5f;
+
+    // The engine is rebuilt in the worker, the current one keeps running until then
+    if (n_frames != 0 && (n_frames != self->block_size
+                          || partition_multiplier != self->partition_multiplier
+                          || freewheel != self->freewheel
+                          || helper != self->helper)) {
+        if (n_frames != self->block_size && (n_frames & (n_frames - 1)) != 0) {
+            lv2_log_warning(&self->logger, "Non standard buffer size: '%i'\n", n_frames);
         }
 
-        self->prev_buffer_size = n_frames;
+        // the helper runs just below the audio thread
+        int priority = 0;
+        if (helper) {
+            int                policy;
+            struct sched_param param;
+            if (pthread_getschedparam(pthread_self(), &policy, &param) == 0
+                && (policy == SCHED_FIFO || policy == SCHED_RR)) {
+                priority = param.sched_priority - 1;
+            }
+        }
 
-        //reset ringbuffer
-        //max ringbuffer size is defined in ringbuffer.h, it should always be > max_overlap_add_buffers * MAX_FFT_SZIE
-        ringbuffer_clear(&self->overlap_buffer, self->overlap_add_buffers * MAX_FFT_SIZE);
+        ConfigureMessage msg = { { sizeof(ConfigureMessage) - sizeof(LV2_Atom), uris->cab_configureEngine },
+            n_frames, partition_multiplier, freewheel, helper, priority };
 
-        memset(self->outbuf, 0, MAX_FFT_SIZE*sizeof(float));
-        memset(self->inbuf, 0, MAX_FFT_SIZE*sizeof(float));
+        if (self->schedule->schedule_work(self->schedule->handle, sizeof(msg), &msg) == LV2_WORKER_SUCCESS) {
+            self->block_size = n_frames;
+            self->partition_multiplier = partition_multiplier;
+            self->freewheel = freewheel;
+            self->helper = helper;
+        }
     }
 
-    //copy inputbuffer and IR buffer with zero padding.
-    if (self->new_ir)
-    {
-        self->valid_IR_data_length = (MAX_FFT_SIZE - n_frames) < self->ir->info.frames ?
-                                  (MAX_FFT_SIZE - n_frames) : self->ir->info.frames;
-        memcpy(IR, self->ir->data, self->valid_IR_data_length*sizeof(float));
-        memset(IR+self->valid_IR_data_length, 0, (MAX_FFT_SIZE - self->valid_IR_data_length)*sizeof(float));
-
-        fftwf_execute(self->IRfft);
+    // State restored without a worker
+    Convolution* const restored = __atomic_exchange_n(&self->restored, NULL, __ATOMIC_ACQUIRE);
+    if (restored) {
+        install_convolution(self, restored);
+    }
 
+    if (self->new_ir && self->conv)
+    {
         lv2_log_trace(&self->logger, "Responding to get request\n");
         lv2_atom_forge_frame_time(&self->forge, self->frame_offset);
-        write_set_file(&self->forge, &self->uris,
-                self->ir->path,
-                self->ir->path_len);
+        if (self->conv->bank) {
+            write_set_file(&self->forge, &self->uris, uris->cab_bank,
+                    self->conv->bank->path,
+                    self->conv->bank->path_len);
+        } else {
+            write_set_file(&self->forge, &self->uris, uris->cab_ir,
+                    self->conv->ir->path,
+                    self->conv->ir->path_len);
+            lv2_atom_forge_frame_time(&self->forge, self->frame_offset);
+            write_set_file(&self->forge, &self->uris, uris->cab_ir2,
+                    self->conv->ir2 ? self->conv->ir2->path : "",
+                    self->conv->ir2 ? self->conv->ir2->path_len : 0);
+        }
 
         self->new_ir = false;
-        self->ir_loaded = true;
+    }
 
-        ringbuffer_clear(&self->overlap_buffer, self->overlap_add_buffers * MAX_FFT_SIZE);
+    if (self->new_layout && self->conv && self->conv->engine)
+    {
+        lv2_atom_forge_frame_time(&self->forge, self->frame_offset);
+        write_set_int(&self->forge, &self->uris, uris->cab_tailBlockSize,
+                (int32_t)self->conv->engine->tail_block_size);
 
-        memset(self->outbuf, 0, MAX_FFT_SIZE*sizeof(float));
-        memset(self->inbuf, 0, MAX_FFT_SIZE*sizeof(float));
+        self->new_layout = false;
     }
 
-    for (i = 0; i < n_frames; i++)
-        inbuf[i] = input[i] * coef * 0.2f;
+    if (self->bank_status)
+    {
+        lv2_atom_forge_frame_time(&self->forge, self->frame_offset);
+        write_set_int(&self->forge, &self->uris, uris->cab_bankLoaded, (int32_t)self->bank_loaded);
+        lv2_atom_forge_frame_time(&self->forge, self->frame_offset);
+        write_set_int(&self->forge, &self->uris, uris->cab_bankSize, (int32_t)self->bank_size);
+        lv2_atom_forge_frame_time(&self->forge, self->frame_offset);
+        write_set_long(&self->forge, &self->uris, uris->cab_bankMemory, (int64_t)self->bank_memory);
 
-    fftwf_execute(self->fft);
+        self->bank_status = false;
+    }
 
-    if (self->ir_loaded) {
+    // Selecting a bank IR fades from the engine with the old kernel to the
+    // other engine, which has been fed the same input all along.  The fade
+    // starts once the output of that engine is all from its new kernel
+    const uint32_t select = self->ir_select_port && *self->ir_select_port > 0.0f
+        ? (uint32_t)(*self->ir_select_port + 0.5f) : 0;
+    __atomic_store_n(&self->bank_index, select, __ATOMIC_RELAXED);
+
+    Convolution* const conv = self->conv;
+    if (conv && conv->kernels && conv->engine && conv->fade_pos == 0) {
+        const uint32_t index = select < conv->kernels->count ? select : conv->kernels->count - 1;
+        if (index != conv->index) {
+            engine_t* const old_engine = conv->engine;
+            engine_set_kernel(conv->fade_engine, &conv->kernels->kernels[index]);
+            conv->engine      = conv->fade_engine;
+            conv->fade_engine = old_engine;
+            conv->index       = index;
+            conv->fade_pos    = (self->fade_length ? self->fade_length : 1) + engine_kernel_delay(conv->engine);
+        }
+    }
 
-        //complex multiplication
-        for (m = 0; m < self->valid_IR_data_length; m++) {
-            self->convolved[m][REAL] = self->outComplex[m][REAL] * self->IRout[m][REAL] - self->outComplex[m][IMAG] * self->IRout[m][IMAG];
-            self->convolved[m][IMAG] = self->outComplex[m][REAL] * self->IRout[m][IMAG] + self->outComplex[m][IMAG] * self->IRout[m][REAL];
+    // The morph kernel is mixed again in passes spread over MORPH_CHUNKS
+    // blocks, each pass moving the amount at most a step towards the port
+    const float morph = self->morph_port ? fminf(fmaxf(*self->morph_port, 0.0f), 1.0f) : 0.0f;
+    __atomic_store(&self->morph, &morph, __ATOMIC_RELAXED);
+
+    if (conv && conv->morph_kernel && conv->engine) {
+        const size_t length = kernel_morph_length(conv->morph_kernel);
+        if (conv->morph_left == 0 && conv->morph != morph) {
+            const float step = fminf((float)(MORPH_CHUNKS * n_frames / (MORPH_TIME * self->samplerate)), 1.0f);
+            conv->morph      = morph > conv->morph ? fminf(conv->morph + step, morph) : fmaxf(conv->morph - step, morph);
+            conv->morph_left = length;
         }
-        memset(self->convolved+m, 0, (MAX_FFT_SIZE-m)*sizeof(fftwf_complex));
+        if (conv->morph_left) {
+            const size_t chunk = (length + MORPH_CHUNKS - 1) / MORPH_CHUNKS;
+            const size_t count = conv->morph_left < chunk ? conv->morph_left : chunk;
+            conv->morph_pos  = kernel_morph(conv->morph_kernel, conv->kernel, conv->kernel2, conv->morph,
+                    conv->morph_pos, count);
+            conv->morph_left -= count;
+        }
+    }
 
-        fftwf_execute(self->ifft);
+    engine_t* const engine = conv ? conv->engine : NULL;
 
-        for (j = 0; j < MAX_FFT_SIZE; j++)
-            ringbuffer_push_sample(&self->overlap_buffer , outbuf[j] / MAX_FFT_SIZE);
+    if (self->latency_port) {
+        *self->latency_port = engine ? (float)engine->latency : 0.0f;
+    }
 
-        //normalize output with overlap add.
-        for (j = 0; j < n_frames; j++) {
-            float overlap_value = 0.0f;
+    // the input level is taken before the gain and headroom
+    float in_peak = 0.0f;
+    float in_sum  = 0.0f;
+    for (i = 0; i < n_frames; i++) {
+        inbuf[i] = input[i] * coef * IR_HEADROOM;
+        in_peak  = fmaxf(in_peak, fabsf(input[i]));
+        in_sum  += input[i] * input[i];
+    }
 
-            for (uint8_t Oa = 0; Oa < self->overlap_add_buffers-1; Oa++)
-                overlap_value += ringbuffer_get_relative_val(&self->overlap_buffer, (Oa * MAX_FFT_SIZE) + ((self->overlap_add_buffers - Oa - 1) * n_frames) + j + 1);
+    for (i = 0; i < n_frames; i++)
+        self->history[(self->history_pos + i) & (HISTORY_SIZE - 1)] = inbuf[i];
+    __atomic_store_n(&self->history_pos, self->history_pos + n_frames, __ATOMIC_RELEASE);
 
-            output[j] = ((outbuf[j] / MAX_FFT_SIZE) + overlap_value);
-        }
+    if (engine) {
+        engine_process(engine, inbuf, output, n_frames);
     } else {
         memset(output, 0, sizeof(float)*n_frames);
     }
+
+    // The idle engine keeps following the input without a kernel, its output
+    // only counts again once a selection gives it one
+    if (engine && conv->fade_engine) {
+        engine_process(conv->fade_engine, inbuf, self->scratch, n_frames);
+
+        for (i = 0; i < n_frames && conv->fade_pos; i++, conv->fade_pos--) {
+            const float gain = fminf((float)conv->fade_pos / (float)(self->fade_length + 1), 1.0f);
+            output[i] += gain * (self->scratch[i] - output[i]);
+        }
+        if (conv->fade_pos == 0) {
+            engine_set_kernel(conv->fade_engine, NULL);
+        }
+    }
+
+    // Output level and samples at or above full scale, on the block while it
+    // is still in cache
+    float    out_peak = 0.0f;
+    float    out_sum  = 0.0f;
+    uint32_t clips    = 0;
+    for (i = 0; i < n_frames; i++) {
+        out_peak = fmaxf(out_peak, fabsf(output[i]));
+        out_sum += output[i] * output[i];
+        clips   += fabsf(output[i]) >= 1.0f;
+    }
+
+    self->meter_in_peak  = fmaxf(self->meter_in_peak, in_peak);
+    self->meter_in_sum  += in_sum;
+    self->meter_out_peak = fmaxf(self->meter_out_peak, out_peak);
+    self->meter_out_sum += out_sum;
+    self->meter_clips   += clips;
+    self->meter_frames  += n_frames;
+
+    if (self->meter_frames && self->meter_frames >= self->meter_period)
+    {
+        const float frames = (float)self->meter_frames;
+
+        lv2_atom_forge_frame_time(&self->forge, self->frame_offset);
+        write_set_float(&self->forge, &self->uris, uris->cab_inputPeak, CO_DB(self->meter_in_peak));
+        lv2_atom_forge_frame_time(&self->forge, self->frame_offset);
+        write_set_float(&self->forge, &self->uris, uris->cab_inputRms, CO_DB(sqrtf(self->meter_in_sum / frames)));
+        lv2_atom_forge_frame_time(&self->forge, self->frame_offset);
+        write_set_float(&self->forge, &self->uris, uris->cab_outputPeak, CO_DB(self->meter_out_peak));
+        lv2_atom_forge_frame_time(&self->forge, self->frame_offset);
+        write_set_float(&self->forge, &self->uris, uris->cab_outputRms, CO_DB(sqrtf(self->meter_out_sum / frames)));
+        lv2_atom_forge_frame_time(&self->forge, self->frame_offset);
+        write_set_int(&self->forge, &self->uris, uris->cab_outputClips, (int32_t)self->meter_clips);
+
+        self->meter_in_peak  = 0.0f;
+        self->meter_in_sum   = 0.0f;
+        self->meter_out_peak = 0.0f;
+        self->meter_out_sum  = 0.0f;
+        self->meter_clips    = 0;
+        self->meter_frames   = 0;
+    }
 }
 
 static LV2_State_Status
@@ -612,10 +2429,31 @@ save(LV2_Handle                instance,
 {
     Cabsim* self = (Cabsim*)instance;
 
-    if (!self->ir) {
+    if (!self->conv) {
         return LV2_STATE_SUCCESS;
     }
 
+    const Bank*            bank = self->conv->bank;
+    const ImpulseResponse* ir   = self->conv->ir;
+
+    // The tuned layout, so a restored session gets it without tuning again
+    if (self->conv->engine) {
+        const TunedLayout* const layout = &self->conv->layout;
+        const struct {
+            LV2_Atom_Vector_Body body;
+            int32_t              values[6];
+        } vector = { { sizeof(int32_t), self->uris.atom_Int },
+            { (int32_t)layout->samplerate, (int32_t)layout->block_size,
+              (int32_t)layout->head_block_size, (int32_t)layout->ir_len,
+              (int32_t)layout->realtime, (int32_t)layout->tail_block_size } };
+        store(handle,
+                self->uris.cab_partitionLayout,
+                &vector,
+                sizeof(vector),
+                self->uris.atom_Vector,
+                LV2_STATE_IS_POD);
+    }
+
     LV2_State_Map_Path* map_path = NULL;
     for (int i = 0; features[i]; ++i) {
         if (!strcmp(features[i]->URI, LV2_STATE__mapPath)) {
@@ -624,11 +2462,23 @@ save(LV2_Handle                instance,
     }
 
     if (map_path) {
-        char* apath = map_path->abstract_path(map_path->handle, self->ir->path);
+        if (self->conv->ir2) {
+            char* const apath2 = map_path->abstract_path(map_path->handle, self->conv->ir2->path);
+            store(handle,
+                    self->uris.cab_ir2,
+                    apath2,
+                    strlen(apath2) + 1,
+                    self->uris.atom_Path,
+                    LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
+            free(apath2);
+        }
+
+        const char* const path  = bank ? bank->path : ir->path;
+        char*             apath = map_path->abstract_path(map_path->handle, path);
         store(handle,
-                self->uris.cab_ir,
+                bank ? self->uris.cab_bank : self->uris.cab_ir,
                 apath,
-                strlen(self->ir->path) + 1,
+                strlen(apath) + 1,
                 self->uris.atom_Path,
                 LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE);
         free(apath);
@@ -638,6 +2488,60 @@ save(LV2_Handle                instance,
     }
 }
 
+typedef struct {
+    Cabsim*      self;
+    Convolution* conv;
+} RestoreResponse;
+
+/**
+   Collect the convolution prepared by a restore without a worker.  Bank
+   loading progress is dropped.
+*/
+static LV2_Worker_Status
+restore_respond(LV2_Worker_Respond_Handle handle,
+                uint32_t                  size,
+                const void*               data)
+{
+    RestoreResponse* const response = (RestoreResponse*)handle;
+    const LV2_Atom* const  atom     = (const LV2_Atom*)data;
+    if (atom->type == response->self->uris.cab_applyImpulseResponse) {
+        free_convolution(response->self, response->conv);
+        response->conv = ((const ConvolutionMessage*)data)->conv;
+    }
+    return LV2_WORKER_SUCCESS;
+}
+
+/**
+   Send the files of a restored state to the worker in one message, see
+   apply_state_files().
+*/
+static LV2_Worker_Status
+schedule_state_files(Cabsim*              self,
+                     LV2_Worker_Schedule* schedule,
+                     LV2_URID             key,
+                     const char*          path,
+                     uint32_t             path_len,
+                     const char*          path2,
+                     uint32_t             path2_len)
+{
+    const uint32_t msg_size = sizeof(StateMessage) + path_len + path2_len;
+    StateMessage* msg = (StateMessage*)malloc(msg_size);
+    if (!msg) {
+        return LV2_WORKER_ERR_NO_SPACE;
+    }
+    msg->atom.size = msg_size - sizeof(LV2_Atom);
+    msg->atom.type = self->uris.cab_restoreState;
+    msg->key       = key;
+    msg->path_len  = path_len;
+    msg->path2_len = path2_len;
+    memcpy((char*)(msg + 1), path, path_len);
+    memcpy((char*)(msg + 1) + path_len, path2, path2_len);
+
+    const LV2_Worker_Status status = schedule->schedule_work(schedule->handle, msg_size, msg);
+    free(msg);
+    return status;
+}
+
 static LV2_State_Status
 restore(LV2_Handle                  instance,
         LV2_State_Retrieve_Function retrieve,
@@ -651,25 +2555,96 @@ restore(LV2_Handle                  instance,
     uint32_t type;
     uint32_t valflags;
 
-    const void* value = retrieve(
+    // Layout tuned when the state was saved, used instead of tuning
+    const LV2_Atom_Vector_Body* vector = (const LV2_Atom_Vector_Body*)retrieve(
             handle,
-            self->uris.cab_ir,
+            self->uris.cab_partitionLayout,
             &size, &type, &valflags);
 
-    if (value) {
-        const char* path = (const char*)value;
-        ImpulseResponse *ir = load_ir(self, path, size);
-        if (ir) {
-            lv2_log_trace(&self->logger, "Restoring file %s\n", path);
-            free_ir(self, self->ir);
-            self->ir = ir;
-            self->new_ir = true;
-        } else {
-            lv2_log_error(&self->logger, "File %s couldn't be loaded\n", path);
-            return LV2_STATE_ERR_UNKNOWN;
+    if (vector && type == self->uris.atom_Vector
+        && size == sizeof(LV2_Atom_Vector_Body) + 6 * sizeof(int32_t)
+        && vector->child_type == self->uris.atom_Int && vector->child_size == sizeof(int32_t)) {
+        const int32_t* const values = (const int32_t*)(vector + 1);
+        const TunedLayout layout = { (uint32_t)values[0], (uint32_t)values[1], (uint32_t)values[2],
+            (uint32_t)values[3], (uint32_t)values[4], (uint32_t)values[5], NULL };
+
+        pthread_mutex_lock(&tuned_lock);
+        read_tuned_layouts();
+        if (!add_tuned_layout(&layout)) {
+            lv2_log_warning(&self->logger, "Ignoring invalid partition layout\n");
+        }
+        pthread_mutex_unlock(&tuned_lock);
+    }
+
+    LV2_Worker_Schedule* schedule = NULL;
+    for (int i = 0; features[i]; ++i) {
+        if (!strcmp(features[i]->URI, LV2_WORKER__schedule)) {
+            schedule = (LV2_Worker_Schedule*)features[i]->data;
         }
     }
 
+    // A state without a second ir stops morphing
+    const void*    value2    = retrieve(
+            handle,
+            self->uris.cab_ir2,
+            &size, &type, &valflags);
+    const char*    path2     = value2 ? (const char*)value2 : "";
+    const uint32_t path2_len = value2 ? (uint32_t)size : 0;
+
+    // A bank takes precedence over the ir it was saved with
+    LV2_URID    key   = self->uris.cab_bank;
+    const void* value = retrieve(
+            handle,
+            key,
+            &size, &type, &valflags);
+
+    if (!value || size <= 1) {
+        key   = self->uris.cab_ir;
+        value = retrieve(
+                handle,
+                key,
+                &size, &type, &valflags);
+    }
+
+    const char*    path     = value ? (const char*)value : "";
+    const uint32_t path_len = value ? (uint32_t)size : 0;
+    if (!value) {
+        key = 0;
+    }
+
+    // Both files go to the worker together, so it prepares one convolution
+    // and the current one keeps playing until that is ready
+    if (schedule) {
+        lv2_log_trace(&self->logger, "Queueing restore of %s\n", value ? path : path2);
+
+        const LV2_Worker_Status status = schedule_state_files(self, schedule, key,
+                path, path_len, path2, path2_len);
+
+        return status == LV2_WORKER_SUCCESS ? LV2_STATE_SUCCESS : LV2_STATE_ERR_UNKNOWN;
+    }
+
+    // Without a worker the files are loaded here, while the instance worker
+    // may be handling a message from run()
+    RestoreResponse response = { self, NULL };
+
+    lv2_log_trace(&self->logger, "Restoring %s %s\n",
+            key == self->uris.cab_bank ? "bank" : "file", value ? path : path2);
+
+    pthread_mutex_lock(&self->worker_lock);
+    const bool loaded = apply_state_files(self, restore_respond, &response, key,
+            path, path_len, path2, path2_len);
+    pthread_mutex_unlock(&self->worker_lock);
+
+    // run() may be running concurrently, it installs the convolution
+    if (response.conv) {
+        free_convolution(self, __atomic_exchange_n(&self->restored, response.conv, __ATOMIC_ACQ_REL));
+    }
+
+    if (!loaded) {
+        lv2_log_error(&self->logger, "File %s couldn't be loaded\n", path);
+        return LV2_STATE_ERR_UNKNOWN;
+    }
+
     return LV2_STATE_SUCCESS;
 }
 
@@ -690,9 +2665,9 @@ static const LV2_Descriptor descriptor = {
     CABSIM_URI,
     instantiate,
     connect_port,
-    NULL,  // activate,
+    activate,
     run,
-    NULL,  // deactivate,
+    deactivate,
     cleanup,
     extension_data
 };
@@ -0,0 +1,155 @@
+/*
+  cabsim-embed: write the default IR as C source, resampled to the common
+  sample rates and with its kernels for the common partition layouts.
+
+  The plugin is built with the output, so instances starting with the
+  default IR neither read the file nor transform anything.
+*/
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "convolver.h"
+#include "default_ir.h"
+#include "ir_loader.h"
+
+static const int samplerates[] = { 44100, 48000, 96000 };
+
+// head partition sizes, with the tail the realtime layout gives them
+#define MIN_HEAD_SIZE 32
+#define MAX_HEAD_SIZE 2048
+
+static void
+write_floats(FILE* out, const char* name, const float* values, size_t count)
+{
+    fprintf(out, "static const float %s[] __attribute__((aligned(64))) = {\n", name);
+    for (size_t i = 0; i < count; i++) {
+        fprintf(out, "%s%a,%s", i % 4 ? " " : "    ", values[i], i % 4 == 3 || i + 1 == count ? "\n" : "");
+    }
+    fprintf(out, "};\n\n");
+}
+
+/**
+   Write the samples and kernels of the IR at @p samplerate, returns the
+   number of kernels or -1 on failure.
+*/
+static int
+write_rate(FILE* out, const char* path, int samplerate, uint32_t* frames)
+{
+    SF_INFO      info;
+    float* const data = ir_load(path, samplerate, &info);
+    if (!data) {
+        fprintf(stderr, "Failed to load %s\n", path);
+        return -1;
+    }
+
+    const uint32_t ir_len = info.frames < IR_MAX_LENGTH ? (uint32_t)info.frames : IR_MAX_LENGTH;
+    char           name[64];
+
+    snprintf(name, sizeof(name), "ir_%d", samplerate);
+    write_floats(out, name, data, ir_len);
+
+    int count = 0;
+    for (uint32_t head = MIN_HEAD_SIZE; head <= MAX_HEAD_SIZE; head *= 2, count++) {
+        engine_layout_t layout;
+        engine_layout_realtime(&layout, head, 1, ir_len);
+
+        kernel_t* const kernel = kernel_new(data, ir_len, &layout, KERNEL_FORMAT_FLOAT);
+        if (!kernel) {
+            fprintf(stderr, "Failed to prepare kernel of %u frames\n", head);
+            free(data);
+            return -1;
+        }
+
+        snprintf(name, sizeof(name), "kernel_%d_%u", samplerate, head);
+        write_floats(out, name, (const float*)kernel->store, kernel_store_size(kernel) / sizeof(float));
+        kernel_free(kernel);
+    }
+
+    fprintf(out, "static const DefaultKernel kernels_%d[] = {\n", samplerate);
+    for (uint32_t head = MIN_HEAD_SIZE; head <= MAX_HEAD_SIZE; head *= 2) {
+        engine_layout_t layout;
+        engine_layout_realtime(&layout, head, 1, ir_len);
+        fprintf(out, "    { %u, %u, kernel_%d_%u, sizeof(kernel_%d_%u) },\n",
+                layout.head_block_size, layout.tail_block_size, samplerate, head, samplerate, head);
+    }
+    fprintf(out, "};\n\n");
+
+    free(data);
+    *frames = ir_len;
+    return count;
+}
+
+static void
+usage(const char* name)
+{
+    fprintf(stderr,
+            "Usage: %s [options] IR\n"
+            "\n"
+            "Writes the IR and its kernels at 44.1, 48 and 96 kHz as C source\n"
+            "\n"
+            "  -o FILE    output file (default: default_ir.c)\n",
+            name);
+}
+
+int
+main(int argc, char** argv)
+{
+    const char* output = "default_ir.c";
+    int         opt;
+
+    while ((opt = getopt(argc, argv, "o:h")) != -1) {
+        switch (opt) {
+            case 'o':
+                output = optarg;
+            break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (optind + 1 != argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE* const out = fopen(output, "w");
+    if (!out) {
+        fprintf(stderr, "Failed to create %s\n", output);
+        return 1;
+    }
+
+    fprintf(out, "// Generated by cabsim-embed from %s, do not edit\n\n", DEFAULT_IR_FILE);
+    fprintf(out, "#include \"default_ir.h\"\n\n");
+
+    const uint32_t n_rates = sizeof(samplerates) / sizeof(samplerates[0]);
+    uint32_t       frames[sizeof(samplerates) / sizeof(samplerates[0])];
+    int            counts[sizeof(samplerates) / sizeof(samplerates[0])];
+
+    for (uint32_t i = 0; i < n_rates; i++) {
+        counts[i] = write_rate(out, argv[optind], samplerates[i], &frames[i]);
+        if (counts[i] < 0) {
+            fclose(out);
+            remove(output);
+            return 1;
+        }
+    }
+
+    fprintf(out, "const DefaultIR default_irs[] = {\n");
+    for (uint32_t i = 0; i < n_rates; i++) {
+        fprintf(out, "    { %d, %u, ir_%d, kernels_%d, %d },\n",
+                samplerates[i], frames[i], samplerates[i], samplerates[i], counts[i]);
+    }
+    fprintf(out, "};\n\nconst uint32_t default_ir_count = %u;\n", n_rates);
+
+    if (fclose(out) != 0) {
+        fprintf(stderr, "Failed to write %s\n", output);
+        remove(output);
+        return 1;
+    }
+
+    return 0;
+}
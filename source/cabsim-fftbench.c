@@ -0,0 +1,233 @@
+/*
+  cabsim-fftbench: report the cost of every FFT backend for the sizes the
+  convolution engine uses, and the backend the engine picks for each.
+
+  FFTW is measured with the wisdom engines would get, from -w or
+  CABSIM_WISDOM and the system wisdom.
+
+  With -k it compares the kernel formats instead: memory, cost per block and
+  the error of the output against float kernels, for a synthetic cabinet IR.
+*/
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "convolver.h"
+
+#define MIN_FFT_SIZE 32
+#define MAX_FFT_SIZE 32768
+
+// blocks of noise each kernel format is timed and compared on
+#define KERNEL_BLOCKS 4096
+
+static void
+print_cost(double seconds, uint32_t size)
+{
+    if (seconds < 0.0) {
+        printf("  %10s %9s", "-", "-");
+    } else {
+        printf("  %7.2f us %6.2f ns", seconds * 1e6, seconds * 1e9 / size);
+    }
+}
+
+static double
+now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+   Run @p blocks blocks of @p input through an engine with a kernel of the
+   given format, returns the seconds per block or a negative time on failure.
+*/
+static double
+run_kernel(const engine_layout_t* layout, const float* ir, uint32_t ir_len, kernel_format_t format,
+           const float* input, float* output, uint32_t blocks, size_t* memory)
+{
+    kernel_t* kernel = kernel_new(ir, ir_len, layout, format);
+    engine_t* engine = engine_new(layout, ir_len);
+    if (!kernel || !engine || !engine_set_kernel(engine, kernel)) {
+        engine_free(engine);
+        kernel_free(kernel);
+        return -1.0;
+    }
+
+    *memory = kernel_store_size(kernel);
+
+    const uint32_t block_size = layout->block_size;
+    const double   start      = now_seconds();
+    for (uint32_t i = 0; i < blocks; i++) {
+        engine_process(engine, input + i * block_size, output + i * block_size, block_size);
+    }
+    const double seconds = (now_seconds() - start) / blocks;
+
+    engine_free(engine);
+    kernel_free(kernel);
+    return seconds;
+}
+
+/**
+   Compare the kernel formats on an exponentially decaying noise IR, the
+   shape of a cabinet IR.
+*/
+static int
+bench_kernels(uint32_t ir_len, uint32_t block_size)
+{
+    const uint32_t frames = KERNEL_BLOCKS * block_size;
+    float* const   ir     = (float*)malloc(sizeof(float) * ir_len);
+    float* const   input  = (float*)malloc(sizeof(float) * frames);
+    float* const   ref    = (float*)malloc(sizeof(float) * frames);
+    float* const   output = (float*)malloc(sizeof(float) * frames);
+    if (!ir || !input || !ref || !output) {
+        free(ir);
+        free(input);
+        free(ref);
+        free(output);
+        return 1;
+    }
+
+    srand(1);
+    for (uint32_t i = 0; i < ir_len; i++) {
+        ir[i] = (2.0f * rand() / RAND_MAX - 1.0f) * expf(-8.0f * i / ir_len);
+    }
+    for (uint32_t i = 0; i < frames; i++) {
+        input[i] = 2.0f * rand() / RAND_MAX - 1.0f;
+    }
+
+    engine_layout_t layout;
+    engine_layout_realtime(&layout, block_size, 1, ir_len);
+
+    printf("IR of %u frames, blocks of %u, tail partitions of %u\n", ir_len, block_size, layout.tail_block_size);
+    printf("format     memory     per block   error rms    error peak\n");
+
+    int failed = 0;
+    for (int format = KERNEL_FORMAT_FLOAT; format <= KERNEL_FORMAT_INT16; format++) {
+        size_t       memory;
+        float* const out     = format == KERNEL_FORMAT_FLOAT ? ref : output;
+        const double seconds = run_kernel(&layout, ir, ir_len, (kernel_format_t)format, input, out, KERNEL_BLOCKS, &memory);
+        if (seconds < 0.0) {
+            fprintf(stderr, "Failed to prepare %s kernel\n", kernel_format_name((kernel_format_t)format));
+            failed = 1;
+            continue;
+        }
+
+        // error relative to the float output, in dB
+        double signal = 0.0, error = 0.0, peak = 0.0, error_peak = 0.0;
+        for (uint32_t i = 0; i < frames; i++) {
+            const double diff = (double)out[i] - ref[i];
+            signal += (double)ref[i] * ref[i];
+            error  += diff * diff;
+            peak       = fmax(peak, fabs(ref[i]));
+            error_peak = fmax(error_peak, fabs(diff));
+        }
+
+        printf("%-6s %8zu B  %9.2f us", kernel_format_name((kernel_format_t)format), memory, seconds * 1e6);
+        if (format == KERNEL_FORMAT_FLOAT) {
+            printf("  %9s    %9s\n", "-", "-");
+        } else {
+            printf("  %6.1f dB    %6.1f dB\n",
+                   10.0 * log10(error / signal + 1e-30), 20.0 * log10(error_peak / peak + 1e-30));
+        }
+    }
+
+    free(ir);
+    free(input);
+    free(ref);
+    free(output);
+    return failed;
+}
+
+static void
+usage(const char* name)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "\n"
+            "Times a forward and inverse real FFT of every power of two size with\n"
+            "each backend, per transform pair and per sample\n"
+            "\n"
+            "  -w FILE    FFTW wisdom written by cabsim-wisdom (default: $CABSIM_WISDOM)\n"
+            "  -l SIZE    smallest FFT size (default: %u)\n"
+            "  -u SIZE    largest FFT size (default: %u)\n"
+            "  -k FRAMES  compare the kernel formats for an IR of this length instead\n"
+            "  -b FRAMES  block size for -k (default: 128)\n",
+            name, MIN_FFT_SIZE, MAX_FFT_SIZE);
+}
+
+int
+main(int argc, char** argv)
+{
+    const char* wisdom   = getenv("CABSIM_WISDOM");
+    long        min_size = MIN_FFT_SIZE;
+    long        max_size = MAX_FFT_SIZE;
+    long        ir_len   = 0;
+    long        block    = 128;
+    int         opt;
+
+    while ((opt = getopt(argc, argv, "w:l:u:k:b:h")) != -1) {
+        switch (opt) {
+            case 'w':
+                wisdom = optarg;
+            break;
+            case 'l':
+                min_size = strtol(optarg, NULL, 10);
+            break;
+            case 'u':
+                max_size = strtol(optarg, NULL, 10);
+            break;
+            case 'k':
+                ir_len = strtol(optarg, NULL, 10);
+            break;
+            case 'b':
+                block = strtol(optarg, NULL, 10);
+            break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (optind != argc || min_size < 2 || max_size < min_size || ir_len < 0
+        || block < 1 || (block & (block - 1)) != 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (wisdom && *wisdom && !convolver_import_wisdom(wisdom)) {
+        fprintf(stderr, "Failed to import wisdom from %s\n", wisdom);
+    }
+    convolver_import_system_wisdom();
+
+    if (ir_len > 0) {
+        return bench_kernels((uint32_t)ir_len, (uint32_t)block);
+    }
+
+    printf("  size  %21s  %21s  engine\n", fft_backend_name(FFT_BACKEND_FFTW), fft_backend_name(FFT_BACKEND_BUILTIN));
+
+    for (uint32_t size = 2; size && size <= (uint32_t)max_size; size *= 2) {
+        if (size < (uint32_t)min_size) {
+            continue;
+        }
+
+        printf("%6u", size);
+        print_cost(fft_benchmark(FFT_BACKEND_FFTW, size), size);
+        print_cost(fft_benchmark(FFT_BACKEND_BUILTIN, size), size);
+
+        // the plan engines get, chosen the same way
+        float*       real     = (float*)fft_malloc(sizeof(float) * size);
+        fft_complex* spectrum = (fft_complex*)fft_malloc(sizeof(fft_complex) * (size / 2 + 1));
+        const fft_plan_t* plan = real && spectrum ? fft_plan(size, real, spectrum) : NULL;
+        printf("  %s\n", plan ? fft_backend_name(fft_plan_backend(plan)) : "-");
+        fft_plan_release(plan);
+        fft_free(real);
+        fft_free(spectrum);
+    }
+
+    return 0;
+}
@@ -0,0 +1,477 @@
+/*
+  cabsim-render: re-amp DI recordings through cabinet IRs offline.
+
+  Uses the same IR loader and convolution engine as the plugin, with the
+  head partitions and latency the plugin uses while the host is
+  freewheeling.  The tail partitions are not tuned, so the output is the
+  same convolution as a latency compensated bounce of the plugin up to
+  rounding.
+*/
+
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sndfile.h>
+
+#include "convolver.h"
+#include "ir_loader.h"
+
+#define MAX_BLOCK_SIZE 2048
+
+//macro for Volume in DB to a coefficient
+#define DB_CO(g) ((g) > -90.0f ? powf(10.0f, (g) * 0.05f) : 0.0f)
+
+typedef struct {
+    const char* input;
+    const char* ir;
+    char*       output;
+
+    // results
+    bool       ok;
+    sf_count_t frames;
+    int        samplerate;
+    int        channels;
+    double     seconds;
+} Job;
+
+typedef struct {
+    Job*            jobs;
+    uint32_t        n_jobs;
+    uint32_t        next_job;
+
+    uint32_t        block_size;
+    uint32_t        partition_multiplier;
+    kernel_format_t format;
+    float           coef;
+
+    pthread_mutex_t print_lock;
+} Renderer;
+
+static double
+now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+   Name of a file without directory and extension.
+*/
+static char*
+file_stem(const char* path)
+{
+    const char* base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+
+    const char* ext = strrchr(base, '.');
+    const size_t len = ext && ext != base ? (size_t)(ext - base) : strlen(base);
+
+    char* stem = (char*)malloc(len + 1);
+    if (stem) {
+        memcpy(stem, base, len);
+        stem[len] = 0;
+    }
+    return stem;
+}
+
+static char*
+output_path(const char* dir, const char* input, const char* ir)
+{
+    char* const input_stem = file_stem(input);
+    char* const ir_stem    = file_stem(ir);
+    char*       path       = NULL;
+
+    if (input_stem && ir_stem) {
+        const size_t len = strlen(dir) + strlen(input_stem) + strlen(ir_stem) + 7;
+        path = (char*)malloc(len);
+        if (path) {
+            snprintf(path, len, "%s/%s_%s.wav", dir, input_stem, ir_stem);
+        }
+    }
+
+    free(input_stem);
+    free(ir_stem);
+    return path;
+}
+
+/**
+   Render one input file through one IR, every channel with its own engine
+   on a shared kernel.
+
+   The input is fed in blocks of block_size like a host would, padded with
+   silence at the end, and the engine latency is dropped from the output.
+*/
+static bool
+render_job(Renderer* renderer, Job* job)
+{
+    const uint32_t block_size = renderer->block_size;
+    bool           ok         = false;
+
+    SF_INFO  in_info;
+    SNDFILE* in = NULL;
+    SNDFILE* out = NULL;
+    float*   ir = NULL;
+    float*   interleaved = NULL;
+    float*   planar_in = NULL;
+    float*   planar_out = NULL;
+    kernel_t*  kernel = NULL;
+    engine_t** engines = NULL;
+    float**    inputs = NULL;
+    float**    outputs = NULL;
+
+    memset(&in_info, 0, sizeof(in_info));
+    in = sf_open(job->input, SFM_READ, &in_info);
+    if (!in) {
+        fprintf(stderr, "Failed to open input '%s': %s\n", job->input, sf_strerror(NULL));
+        return false;
+    }
+
+    const uint32_t channels = (uint32_t)in_info.channels;
+
+    SF_INFO ir_info;
+    ir = ir_load(job->ir, in_info.samplerate, &ir_info);
+    if (!ir) {
+        fprintf(stderr, "Failed to open ir '%s'\n", job->ir);
+        goto done;
+    }
+
+    const uint32_t ir_len = ir_info.frames < IR_MAX_LENGTH ? (uint32_t)ir_info.frames : IR_MAX_LENGTH;
+
+    // the plugin tunes the tail of this layout on the machine, which only
+    // changes the rounding
+    engine_layout_t layout;
+    engine_layout_throughput(&layout, block_size, renderer->partition_multiplier, ir_len);
+
+    // one kernel for all channels
+    kernel = kernel_new(ir, ir_len, &layout, renderer->format);
+    engines = (engine_t**)calloc(channels, sizeof(engine_t*));
+    if (!kernel || !engines) {
+        fprintf(stderr, "Failed to prepare kernel for '%s'\n", job->ir);
+        goto done;
+    }
+    for (uint32_t c = 0; c < channels; c++) {
+        engines[c] = engine_new(&layout, ir_len);
+        if (!engines[c] || !engine_set_kernel(engines[c], kernel)) {
+            fprintf(stderr, "Failed to prepare engine for '%s'\n", job->ir);
+            goto done;
+        }
+    }
+
+    // outputs are always named .wav, keep the sample format of the input if
+    // WAV can hold it
+    SF_INFO out_info;
+    memset(&out_info, 0, sizeof(out_info));
+    out_info.samplerate = in_info.samplerate;
+    out_info.channels   = in_info.channels;
+    out_info.format     = SF_FORMAT_WAV | (in_info.format & SF_FORMAT_SUBMASK);
+    if (!sf_format_check(&out_info)) {
+        out_info.format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+    }
+    out = sf_open(job->output, SFM_WRITE, &out_info);
+    if (!out) {
+        fprintf(stderr, "Failed to create output '%s': %s\n", job->output, sf_strerror(NULL));
+        goto done;
+    }
+
+    interleaved = (float*)malloc(sizeof(float) * block_size * channels);
+    planar_in   = (float*)malloc(sizeof(float) * block_size * channels);
+    planar_out  = (float*)malloc(sizeof(float) * block_size * channels);
+    inputs      = (float**)malloc(sizeof(float*) * channels);
+    outputs     = (float**)malloc(sizeof(float*) * channels);
+    if (!interleaved || !planar_in || !planar_out || !inputs || !outputs) {
+        goto done;
+    }
+    for (uint32_t c = 0; c < channels; c++) {
+        inputs[c]  = planar_in + c * block_size;
+        outputs[c] = planar_out + c * block_size;
+    }
+
+    const uint32_t latency = engines[0]->latency;
+    uint32_t   skip    = latency;
+    sf_count_t written = 0;
+    bool       eof     = false;
+
+    while (written < in_info.frames) {
+        sf_count_t n = 0;
+        if (!eof) {
+            n = sf_readf_float(in, interleaved, block_size);
+            eof = n < (sf_count_t)block_size;
+        }
+        memset(interleaved + n * channels, 0, sizeof(float) * (block_size - n) * channels);
+
+        for (uint32_t c = 0; c < channels; c++) {
+            for (uint32_t i = 0; i < block_size; i++)
+                inputs[c][i] = interleaved[i * channels + c] * renderer->coef * IR_HEADROOM;
+        }
+
+        engine_process_batch(engines, (const float* const*)inputs, outputs, channels, block_size);
+
+        const uint32_t offset = skip < block_size ? skip : block_size;
+        skip -= offset;
+
+        sf_count_t frames = block_size - offset;
+        if (written + frames > in_info.frames) {
+            frames = in_info.frames - written;
+        }
+
+        for (sf_count_t i = 0; i < frames; i++) {
+            for (uint32_t c = 0; c < channels; c++)
+                interleaved[i * channels + c] = outputs[c][offset + i];
+        }
+
+        if (sf_writef_float(out, interleaved, frames) != frames) {
+            fprintf(stderr, "Failed to write '%s': %s\n", job->output, sf_strerror(out));
+            goto done;
+        }
+        written += frames;
+    }
+
+    job->frames     = in_info.frames;
+    job->samplerate = in_info.samplerate;
+    job->channels   = in_info.channels;
+    ok = true;
+
+done:
+    if (engines) {
+        for (uint32_t c = 0; c < channels; c++)
+            engine_free(engines[c]);
+        free(engines);
+    }
+    kernel_free(kernel);
+    free(inputs);
+    free(outputs);
+    free(interleaved);
+    free(planar_in);
+    free(planar_out);
+    free(ir);
+    if (out) {
+        sf_close(out);
+    }
+    sf_close(in);
+    return ok;
+}
+
+static void*
+render_thread(void* arg)
+{
+    Renderer* renderer = (Renderer*)arg;
+
+    for (;;) {
+        const uint32_t index = __atomic_fetch_add(&renderer->next_job, 1, __ATOMIC_RELAXED);
+        if (index >= renderer->n_jobs) {
+            break;
+        }
+
+        Job* const job = &renderer->jobs[index];
+        const double start = now_seconds();
+        job->ok = render_job(renderer, job);
+        job->seconds = now_seconds() - start;
+
+        if (job->ok) {
+            const double audio_seconds = (double)job->frames / job->samplerate;
+            pthread_mutex_lock(&renderer->print_lock);
+            printf("%s: %.1f s of audio in %.2f s, %.1fx realtime\n",
+                   job->output, audio_seconds, job->seconds,
+                   job->seconds > 0.0 ? audio_seconds / job->seconds : 0.0);
+            pthread_mutex_unlock(&renderer->print_lock);
+        }
+    }
+
+    return NULL;
+}
+
+static void
+usage(const char* name)
+{
+    fprintf(stderr,
+            "Usage: %s [options] -i IR.wav [-i IR.wav ...] INPUT.wav [INPUT.wav ...]\n"
+            "\n"
+            "Renders every input through every IR into OUTDIR/INPUT_IR.wav\n"
+            "\n"
+            "  -i IR      impulse response, can be given several times\n"
+            "  -o OUTDIR  output directory (default: .)\n"
+            "  -j N       number of threads (default: number of CPUs)\n"
+            "  -b FRAMES  host block size to match, power of two (default: 128)\n"
+            "  -m MODE    latency mode, 0 = zero latency, 1-3 = 2x/4x/8x block (default: 0)\n"
+            "  -g DB      input gain in dB, -90 to 0 (default: 0)\n"
+            "  -w FILE    FFTW wisdom written by cabsim-wisdom (default: $CABSIM_WISDOM)\n"
+            "  -k FORMAT  kernel format, float, half or int16 (default: float)\n",
+            name);
+}
+
+int
+main(int argc, char** argv)
+{
+    const char**    irs        = (const char**)calloc(argc, sizeof(char*));
+    uint32_t        n_irs      = 0;
+    const char*     output_dir = ".";
+    long            n_threads  = sysconf(_SC_NPROCESSORS_ONLN);
+    long            block_size = 128;
+    long            mode       = 0;
+    float           gain       = 0.0f;
+    const char*     wisdom     = getenv("CABSIM_WISDOM");
+    kernel_format_t format     = KERNEL_FORMAT_FLOAT;
+    int             opt;
+
+    while ((opt = getopt(argc, argv, "i:o:j:b:m:g:w:k:h")) != -1) {
+        switch (opt) {
+            case 'i':
+                irs[n_irs++] = optarg;
+            break;
+            case 'o':
+                output_dir = optarg;
+            break;
+            case 'j':
+                n_threads = strtol(optarg, NULL, 10);
+            break;
+            case 'b':
+                block_size = strtol(optarg, NULL, 10);
+            break;
+            case 'm':
+                mode = strtol(optarg, NULL, 10);
+            break;
+            case 'g':
+                gain = strtof(optarg, NULL);
+            break;
+            case 'w':
+                wisdom = optarg;
+            break;
+            case 'k':
+                if (!kernel_format_parse(optarg, &format)) {
+                    usage(argv[0]);
+                    free(irs);
+                    return 1;
+                }
+            break;
+            default:
+                usage(argv[0]);
+                free(irs);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (n_irs == 0 || optind >= argc
+        || block_size < 1 || block_size > MAX_BLOCK_SIZE || (block_size & (block_size - 1)) != 0
+        || mode < 0 || mode > 3) {
+        usage(argv[0]);
+        free(irs);
+        return 1;
+    }
+    if (n_threads < 1) {
+        n_threads = 1;
+    }
+
+    const uint32_t n_inputs = (uint32_t)(argc - optind);
+
+    Renderer renderer;
+    memset(&renderer, 0, sizeof(renderer));
+    renderer.n_jobs               = n_inputs * n_irs;
+    renderer.jobs                 = (Job*)calloc(renderer.n_jobs, sizeof(Job));
+    renderer.block_size           = (uint32_t)block_size;
+    renderer.partition_multiplier = 1u << mode;
+    renderer.format               = format;
+    renderer.coef                 = DB_CO(gain > 0.0f ? 0.0f : gain);
+    pthread_mutex_init(&renderer.print_lock, NULL);
+
+    if (!renderer.jobs) {
+        free(irs);
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < n_inputs; i++) {
+        for (uint32_t j = 0; j < n_irs; j++) {
+            Job* const job = &renderer.jobs[i * n_irs + j];
+            job->input  = argv[optind + i];
+            job->ir     = irs[j];
+            job->output = output_path(output_dir, job->input, job->ir);
+        }
+    }
+
+    // inputs or IRs with the same name from different directories would
+    // overwrite each other's output
+    bool clash = false;
+    for (uint32_t i = 0; i < renderer.n_jobs; i++) {
+        const Job* const job = &renderer.jobs[i];
+        if (!job->output) {
+            fprintf(stderr, "Failed to allocate output path for '%s'\n", job->input);
+            clash = true;
+            continue;
+        }
+        for (uint32_t k = 0; k < i; k++) {
+            const Job* const other = &renderer.jobs[k];
+            if (other->output && strcmp(job->output, other->output) == 0) {
+                fprintf(stderr, "'%s' through '%s' and '%s' through '%s' both render to '%s'\n",
+                        other->input, other->ir, job->input, job->ir, job->output);
+                clash = true;
+                break;
+            }
+        }
+    }
+    if (clash) {
+        for (uint32_t i = 0; i < renderer.n_jobs; i++) {
+            free(renderer.jobs[i].output);
+        }
+        pthread_mutex_destroy(&renderer.print_lock);
+        free(renderer.jobs);
+        free(irs);
+        return 1;
+    }
+
+    if ((uint32_t)n_threads > renderer.n_jobs) {
+        n_threads = renderer.n_jobs;
+    }
+
+    if (wisdom && *wisdom && !convolver_import_wisdom(wisdom)) {
+        fprintf(stderr, "Failed to import wisdom from %s\n", wisdom);
+    }
+    convolver_import_system_wisdom();
+
+    const double start = now_seconds();
+
+    pthread_t* threads = (pthread_t*)calloc(n_threads, sizeof(pthread_t));
+    long started = 0;
+    for (; threads && started < n_threads; started++) {
+        if (pthread_create(&threads[started], NULL, render_thread, &renderer) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        // render on this thread if none could be started
+        render_thread(&renderer);
+    }
+    for (long t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    const double elapsed = now_seconds() - start;
+
+    double   audio_seconds = 0.0;
+    uint32_t failed        = 0;
+    for (uint32_t i = 0; i < renderer.n_jobs; i++) {
+        if (renderer.jobs[i].ok) {
+            audio_seconds += (double)renderer.jobs[i].frames / renderer.jobs[i].samplerate;
+        } else {
+            failed++;
+        }
+        free(renderer.jobs[i].output);
+    }
+
+    printf("Rendered %u of %u files, %.1f s of audio in %.2f s on %ld threads, %.1fx realtime\n",
+           renderer.n_jobs - failed, renderer.n_jobs, audio_seconds, elapsed, started ? started : 1,
+           elapsed > 0.0 ? audio_seconds / elapsed : 0.0);
+
+    pthread_mutex_destroy(&renderer.print_lock);
+    free(threads);
+    free(renderer.jobs);
+    free(irs);
+
+    return failed ? 1 : 0;
+}
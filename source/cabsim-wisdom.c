@@ -0,0 +1,226 @@
+/*
+  cabsim-wisdom: plan every FFT size the convolution engine can use and
+  write the result as an FFTW wisdom file.
+
+  The plugin and cabsim-render load the wisdom from the plugin bundle, or
+  from the file named by CABSIM_WISDOM, so their plans are measured on the
+  machine instead of estimated.  Run it on the target CPU.
+*/
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fftw3.h"
+
+// partitions of 16 frames up to 8x a block of 2048, and the tail partitions
+#define MIN_FFT_SIZE 32
+#define MAX_FFT_SIZE 32768
+
+static double
+now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+   Average seconds of a forward and inverse transform with the given plans,
+   on the arrays they were planned for.
+*/
+static double
+time_plans(fftwf_plan r2c, fftwf_plan c2r, float* real, fftwf_complex* spectrum, uint32_t size)
+{
+    const uint32_t iterations = 1 + (1u << 22) / size;
+
+    const double start = now_seconds();
+    for (uint32_t i = 0; i < iterations; i++) {
+        fftwf_execute_dft_r2c(r2c, real, spectrum);
+        fftwf_execute_dft_c2r(c2r, spectrum, real);
+    }
+
+    return (now_seconds() - start) / iterations;
+}
+
+/**
+   Average seconds of a forward and inverse transform of @p size, planned with
+   @p flags and the same array alignment as the engine uses.  Returns a
+   negative time if the plans could not be made.
+*/
+static double
+plan_size(uint32_t size, unsigned flags, double* planning)
+{
+    float*         real     = (float*)fftwf_malloc(sizeof(float) * size);
+    fftwf_complex* spectrum = (fftwf_complex*)fftwf_malloc(sizeof(fftwf_complex) * (size / 2 + 1));
+    if (!real || !spectrum) {
+        fftwf_free(real);
+        fftwf_free(spectrum);
+        return -1.0;
+    }
+
+    // planning with anything but FFTW_ESTIMATE overwrites the arrays
+    const double start = now_seconds();
+    fftwf_plan   r2c   = fftwf_plan_dft_r2c_1d(size, real, spectrum, flags);
+    fftwf_plan   c2r   = fftwf_plan_dft_c2r_1d(size, spectrum, real, flags);
+    *planning = now_seconds() - start;
+
+    double seconds = -1.0;
+    if (r2c && c2r) {
+        memset(real, 0, sizeof(float) * size);
+        seconds = time_plans(r2c, c2r, real, spectrum, size);
+    }
+
+    if (r2c) fftwf_destroy_plan(r2c);
+    if (c2r) fftwf_destroy_plan(c2r);
+    fftwf_free(real);
+    fftwf_free(spectrum);
+
+    return seconds;
+}
+
+static void
+usage(const char* name)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "\n"
+            "Plans the forward and inverse real FFTs of every power of two size the\n"
+            "convolution engine uses and writes them as FFTW wisdom\n"
+            "\n"
+            "  -o FILE    output file (default: cabsim.wisdom)\n"
+            "  -a         add to the wisdom already in the output file\n"
+            "  -p LEVEL   planner effort, measure, patient or exhaustive (default: patient)\n"
+            "  -t SECS    time limit for planning each transform (default: none)\n"
+            "  -l SIZE    smallest FFT size (default: %u)\n"
+            "  -u SIZE    largest FFT size (default: %u)\n"
+            "  -s SIZE    also plan this size, can be given several times\n",
+            name, MIN_FFT_SIZE, MAX_FFT_SIZE);
+}
+
+int
+main(int argc, char** argv)
+{
+    // extra sizes from the command line, and up to 32 powers of two
+    uint32_t*   sizes    = (uint32_t*)calloc(argc + 32, sizeof(uint32_t));
+    double*     before   = (double*)calloc(argc + 32, sizeof(double));
+    uint32_t    n_sizes  = 0;
+    const char* output   = "cabsim.wisdom";
+    bool        append   = false;
+    unsigned    flags    = FFTW_PATIENT;
+    double      limit    = -1.0;
+    long        min_size = MIN_FFT_SIZE;
+    long        max_size = MAX_FFT_SIZE;
+    int         opt;
+
+    if (!sizes || !before) {
+        free(sizes);
+        free(before);
+        return 1;
+    }
+
+    while ((opt = getopt(argc, argv, "o:ap:t:l:u:s:h")) != -1) {
+        switch (opt) {
+            case 'o':
+                output = optarg;
+            break;
+            case 'a':
+                append = true;
+            break;
+            case 'p':
+                if (!strcmp(optarg, "measure")) {
+                    flags = FFTW_MEASURE;
+                } else if (!strcmp(optarg, "patient")) {
+                    flags = FFTW_PATIENT;
+                } else if (!strcmp(optarg, "exhaustive")) {
+                    flags = FFTW_EXHAUSTIVE;
+                } else {
+                    usage(argv[0]);
+                    free(sizes);
+                    free(before);
+                    return 1;
+                }
+            break;
+            case 't':
+                limit = strtod(optarg, NULL);
+            break;
+            case 'l':
+                min_size = strtol(optarg, NULL, 10);
+            break;
+            case 'u':
+                max_size = strtol(optarg, NULL, 10);
+            break;
+            case 's':
+                sizes[n_sizes] = (uint32_t)strtol(optarg, NULL, 10);
+                if (sizes[n_sizes] >= 2 && sizes[n_sizes] % 2 == 0) {
+                    n_sizes++;
+                }
+            break;
+            default:
+                usage(argv[0]);
+                free(sizes);
+                free(before);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (optind != argc || min_size < 2 || max_size < min_size) {
+        usage(argv[0]);
+        free(sizes);
+        free(before);
+        return 1;
+    }
+
+    if (append && !fftwf_import_wisdom_from_filename(output)) {
+        fprintf(stderr, "Failed to import wisdom from %s, starting over\n", output);
+    }
+    if (limit > 0.0) {
+        fftwf_set_timelimit(limit);
+    }
+
+    for (uint32_t size = 2; size && size <= (uint32_t)max_size; size *= 2) {
+        if (size >= (uint32_t)min_size) {
+            sizes[n_sizes++] = size;
+        }
+    }
+
+    // time the plans the engine gets without this wisdom first, planning
+    // adds wisdom that estimated plans use as well
+    for (uint32_t i = 0; i < n_sizes; i++) {
+        double planning;
+        before[i] = plan_size(sizes[i], FFTW_ESTIMATE, &planning);
+    }
+
+    printf("  size     before    planned  speedup\n");
+
+    uint32_t failed = 0;
+    for (uint32_t i = 0; i < n_sizes; i++) {
+        double       planning;
+        const double seconds = plan_size(sizes[i], flags, &planning);
+        if (seconds < 0.0 || before[i] < 0.0) {
+            fprintf(stderr, "Failed to plan size %u\n", sizes[i]);
+            failed++;
+            continue;
+        }
+        printf("%6u  %6.2f us  %6.2f us  %5.2fx  (planned in %.1f s)\n",
+               sizes[i], before[i] * 1e6, seconds * 1e6,
+               seconds > 0.0 ? before[i] / seconds : 0.0, planning);
+    }
+
+    if (!fftwf_export_wisdom_to_filename(output)) {
+        fprintf(stderr, "Failed to write wisdom to %s\n", output);
+        free(sizes);
+        free(before);
+        return 1;
+    }
+
+    printf("Wrote wisdom to %s\n", output);
+    free(sizes);
+    free(before);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,1618 @@
+#include "convolver.h"
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define REAL 0
+#define IMAG 1
+
+// alignment of every stage in a kernel store
+#define STORE_ALIGNMENT 64
+
+// frames the tuner times each candidate layout for, at least four tail
+// partitions, and the number of timed runs
+#define TUNE_FRAMES 16384
+#define TUNE_RUNS   3
+
+bool convolver_import_wisdom(const char *path)
+{
+    return fft_import_wisdom(path);
+}
+
+bool convolver_import_system_wisdom(void)
+{
+    return fft_import_wisdom(NULL);
+}
+
+static void complex_multiply_accumulate(fft_complex *result, const fft_complex *a, const fft_complex *b, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; i++) {
+        result[i][REAL] += a[i][REAL] * b[i][REAL] - a[i][IMAG] * b[i][IMAG];
+        result[i][IMAG] += a[i][REAL] * b[i][IMAG] + a[i][IMAG] * b[i][REAL];
+    }
+}
+
+static uint16_t float_to_half_bits(float value)
+{
+    union { float f; uint32_t u; } bits = { value };
+    const uint16_t sign = (bits.u >> 16) & 0x8000;
+    const float magnitude = fabsf(value);
+
+    // largest finite half, the kernel scales keep values well below it
+    if (magnitude >= 65504.0f)
+        return sign | 0x7bff;
+
+    // no subnormals, they would be denormal floats in the multiply-accumulate,
+    // the kernel scales put them 2^28 below the largest value of a partition
+    if (magnitude < 6.103515625e-05f)
+        return sign;
+
+    // rebias the exponent and round the mantissa to nearest even
+    bits.u &= 0x7fffffff;
+    bits.u += ((uint32_t)(15 - 127) << 23) + 0xfff + ((bits.u >> 13) & 1);
+    return sign | (uint16_t)(bits.u >> 13);
+}
+
+/*
+  Multiply-accumulate with half or int16 IR spectra, expanded to float on the
+  fly.  The bits of a half moved into a float are its value times 2^-112, the
+  difference of the exponent biases, the half scales make up for that.
+
+  len is the number of bins, block_size + 1, which is neither a multiple of
+  two nor of the scale block.  The loops run on in whole vectors and scale
+  blocks up to the complex stride instead: the packed spectra, their scales,
+  the input spectra and the result are all allocated to the stride (see
+  complex_stride()), and the packed bins past len are stored as zero, so the
+  extra bins only add to the unused padding of the result.  Storage trimmed
+  to len would make these loops read out of bounds.
+*/
+#if defined(__GNUC__) && !defined(FFT_NO_SIMD)
+
+typedef float v4sf __attribute__((vector_size(16), aligned(4), may_alias));
+typedef int32_t v4si __attribute__((vector_size(16)));
+typedef uint32_t v4su __attribute__((vector_size(16)));
+typedef int16_t v4hi __attribute__((vector_size(8), aligned(2), may_alias));
+typedef uint16_t v4hu __attribute__((vector_size(8), aligned(2), may_alias));
+
+// two interleaved bins of a times b, added to result
+static inline void multiply_accumulate_2(float *result, v4sf a, const float *b)
+{
+    const v4sf vb = *(const v4sf*)b;
+    const v4sf a_real = __builtin_shuffle(a, (v4si){ 0, 0, 2, 2 });
+    const v4sf a_imag = __builtin_shuffle(a, (v4si){ 1, 1, 3, 3 });
+    const v4sf b_swapped = __builtin_shuffle(vb, (v4si){ 1, 0, 3, 2 });
+    const v4sf sign = { -1.0f, 1.0f, -1.0f, 1.0f };
+
+    *(v4sf*)result += a_real * vb + a_imag * b_swapped * sign;
+}
+
+static void complex_multiply_accumulate_half(fft_complex *result, const uint16_t *a, float scale, const fft_complex *b, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; i += 2) {
+        const v4su half = __builtin_convertvector(*(const v4hu*)(a + 2 * i), v4su);
+        const v4su bits = ((half & 0x7fff) << 13) | ((half & 0x8000) << 16);
+        multiply_accumulate_2(result[i], (v4sf)bits * scale, b[i]);
+    }
+}
+
+static void complex_multiply_accumulate_int16(fft_complex *result, const int16_t *a, const float *scales, const fft_complex *b, uint32_t len)
+{
+    for (uint32_t block = 0; block < len; block += KERNEL_SCALE_BLOCK) {
+        const float scale = scales[block / KERNEL_SCALE_BLOCK];
+        for (uint32_t i = block; i < block + KERNEL_SCALE_BLOCK; i += 2) {
+            const v4sf value = __builtin_convertvector(*(const v4hi*)(a + 2 * i), v4sf);
+            multiply_accumulate_2(result[i], value * scale, b[i]);
+        }
+    }
+}
+
+#else
+
+static float half_bits_to_float(uint16_t half)
+{
+    const uint32_t bits = ((uint32_t)(half & 0x7fff) << 13) | ((uint32_t)(half & 0x8000) << 16);
+    float value;
+    memcpy(&value, &bits, sizeof(float));
+    return value;
+}
+
+static void complex_multiply_accumulate_half(fft_complex *result, const uint16_t *a, float scale, const fft_complex *b, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; i++) {
+        const float a_real = half_bits_to_float(a[2 * i + REAL]) * scale;
+        const float a_imag = half_bits_to_float(a[2 * i + IMAG]) * scale;
+        result[i][REAL] += a_real * b[i][REAL] - a_imag * b[i][IMAG];
+        result[i][IMAG] += a_real * b[i][IMAG] + a_imag * b[i][REAL];
+    }
+}
+
+static void complex_multiply_accumulate_int16(fft_complex *result, const int16_t *a, const float *scales, const fft_complex *b, uint32_t len)
+{
+    for (uint32_t block = 0; block < len; block += KERNEL_SCALE_BLOCK) {
+        const float scale = scales[block / KERNEL_SCALE_BLOCK];
+        for (uint32_t i = block; i < block + KERNEL_SCALE_BLOCK; i++) {
+            const float a_real = a[2 * i + REAL] * scale;
+            const float a_imag = a[2 * i + IMAG] * scale;
+            result[i][REAL] += a_real * b[i][REAL] - a_imag * b[i][IMAG];
+            result[i][IMAG] += a_real * b[i][IMAG] + a_imag * b[i][REAL];
+        }
+    }
+}
+
+#endif
+
+// IR segment @p index of @p stage times @p b, added to @p result
+static void kernel_multiply_accumulate(fft_complex *result, const kernel_stage_t *stage, uint32_t index, const fft_complex *b, uint32_t len)
+{
+    const uint32_t stride = stage->complex_stride;
+
+    switch (stage->format) {
+    case KERNEL_FORMAT_HALF:
+        complex_multiply_accumulate_half(result, stage->segments_packed + 2 * index * stride,
+                stage->scales[index], b, len);
+        break;
+    case KERNEL_FORMAT_INT16:
+        complex_multiply_accumulate_int16(result, (const int16_t*)stage->segments_packed + 2 * index * stride,
+                stage->scales + index * (stride / KERNEL_SCALE_BLOCK), b, len);
+        break;
+    default:
+        complex_multiply_accumulate(result, stage->segments_ir + index * stride, b, len);
+        break;
+    }
+}
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t min_u32(uint32_t a, uint32_t b)
+{
+    return a < b ? a : b;
+}
+
+static uint32_t complex_stride(uint32_t block_size)
+{
+    // keep every segment aligned for SIMD and for plans shared between arrays
+    return (block_size + 1 + 7) & ~7u;
+}
+
+// ----------------------------------------------------------------------------
+// Kernel preparation
+
+// parts of an IR of ir_len frames covered by the head, first tail and tail stages
+static void layout_split(const engine_layout_t *layout, uint32_t ir_len, uint32_t lens[3])
+{
+    const uint32_t tail_size = layout->tail_block_size;
+
+    if (tail_size == 0) {
+        lens[0] = ir_len;
+        lens[1] = 0;
+        lens[2] = 0;
+        return;
+    }
+
+    lens[0] = min_u32(ir_len, tail_size);
+    lens[1] = min_u32(ir_len - lens[0], tail_size);
+    lens[2] = ir_len - lens[0] - lens[1];
+}
+
+static kernel_stage_t * kernel_stage(kernel_t *kernel, int index)
+{
+    return index == 0 ? &kernel->head : index == 1 ? &kernel->tail0 : &kernel->tail;
+}
+
+static const char *const kernel_format_names[] = { "float", "half", "int16" };
+
+bool kernel_format_parse(const char *name, kernel_format_t *format)
+{
+    for (int i = 0; i < 3; i++) {
+        if (!strcmp(name, kernel_format_names[i])) {
+            *format = (kernel_format_t) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char * kernel_format_name(kernel_format_t format)
+{
+    return (unsigned) format < 3 ? kernel_format_names[format] : "unknown";
+}
+
+// bytes of the spectra and scales of a stage, rounded up to keep the next
+// stage aligned
+static size_t stage_store_size(const kernel_stage_t *stage)
+{
+    const size_t values = (size_t)stage->complex_stride * stage->seg_count;
+    size_t size;
+
+    switch (stage->format) {
+    case KERNEL_FORMAT_HALF:
+        size = 2 * sizeof(uint16_t) * values + sizeof(float) * stage->seg_count;
+        break;
+    case KERNEL_FORMAT_INT16:
+        size = 2 * sizeof(int16_t) * values + sizeof(float) * (values / KERNEL_SCALE_BLOCK);
+        break;
+    default:
+        size = sizeof(fft_complex) * values;
+        break;
+    }
+
+    return (size + STORE_ALIGNMENT - 1) & ~(size_t)(STORE_ALIGNMENT - 1);
+}
+
+/**
+   Set up the stages of @p kernel for an IR and return the bytes of store
+   they need, without transforming anything yet.
+*/
+static size_t kernel_size(kernel_t *kernel, const float *ir, uint32_t ir_len, const engine_layout_t *layout, kernel_format_t format)
+{
+    memset(kernel, 0, sizeof(kernel_t));
+    kernel->layout = *layout;
+
+    uint32_t lens[3];
+    layout_split(layout, ir_len, lens);
+
+    size_t size = 0;
+    uint32_t offset = 0;
+
+    for (int i = 0; i < 3; i++) {
+        kernel_stage_t *stage = kernel_stage(kernel, i);
+        uint32_t len = lens[i];
+
+        // trailing zeros only cost partitions
+        while (len > 0 && ir[offset + len - 1] == 0.0f)
+            len--;
+
+        stage->block_size = i < 2 ? layout->head_block_size : layout->tail_block_size;
+        stage->complex_stride = complex_stride(stage->block_size);
+        stage->seg_count = stage->block_size ? (len + stage->block_size - 1) / stage->block_size : 0;
+        stage->format = format;
+
+        size += stage_store_size(stage);
+        offset += lens[i];
+    }
+
+    return size;
+}
+
+/**
+   Store the spectrum of segment @p index of a half or int16 stage, scaled
+   so the largest value of the segment, or of a block of bins, keeps the
+   full precision.
+*/
+static void kernel_stage_pack(kernel_stage_t *stage, uint32_t index, const fft_complex *spectrum)
+{
+    const uint32_t stride = stage->complex_stride;
+    const uint32_t size = stage->block_size + 1;
+    uint16_t *packed = stage->segments_packed + 2 * index * stride;
+
+    if (stage->format == KERNEL_FORMAT_HALF) {
+        float peak = 0.0f;
+        for (uint32_t i = 0; i < size; i++)
+            peak = fmaxf(peak, fmaxf(fabsf(spectrum[i][REAL]), fabsf(spectrum[i][IMAG])));
+
+        // the peak ends up between 2^13 and 2^14, leaving headroom to the
+        // largest half
+        int exponent = 0;
+        frexpf(peak, &exponent);
+        const int shift = peak > 0.0f ? 14 - exponent : 0;
+
+        for (uint32_t i = 0; i < stride; i++) {
+            packed[2 * i + REAL] = i < size ? float_to_half_bits(ldexpf(spectrum[i][REAL], shift)) : 0;
+            packed[2 * i + IMAG] = i < size ? float_to_half_bits(ldexpf(spectrum[i][IMAG], shift)) : 0;
+        }
+        stage->scales[index] = ldexpf(1.0f, 112 - shift);
+    } else {
+        int16_t *values = (int16_t*) packed;
+        float *scales = stage->scales + index * (stride / KERNEL_SCALE_BLOCK);
+
+        for (uint32_t block = 0; block < stride; block += KERNEL_SCALE_BLOCK) {
+            float peak = 0.0f;
+            for (uint32_t i = block; i < block + KERNEL_SCALE_BLOCK && i < size; i++)
+                peak = fmaxf(peak, fmaxf(fabsf(spectrum[i][REAL]), fabsf(spectrum[i][IMAG])));
+
+            const float scale = peak / 32767.0f;
+            for (uint32_t i = block; i < block + KERNEL_SCALE_BLOCK; i++) {
+                values[2 * i + REAL] = i < size && peak > 0.0f ? (int16_t) lrintf(spectrum[i][REAL] / scale) : 0;
+                values[2 * i + IMAG] = i < size && peak > 0.0f ? (int16_t) lrintf(spectrum[i][IMAG] / scale) : 0;
+            }
+            scales[block / KERNEL_SCALE_BLOCK] = scale;
+        }
+    }
+}
+
+static bool kernel_stage_transform(kernel_stage_t *stage, const float *ir, uint32_t ir_len)
+{
+    if (stage->seg_count == 0)
+        return true;
+
+    const uint32_t block_size = stage->block_size;
+    const uint32_t seg_size = 2 * block_size;
+    const bool packed = stage->format != KERNEL_FORMAT_FLOAT;
+
+    float *fft_buffer = (float*) fft_malloc(sizeof(float) * seg_size);
+    // packed spectra go through one float segment
+    fft_complex *spectrum = packed ? (fft_complex*) fft_malloc(sizeof(fft_complex) * stage->complex_stride) : NULL;
+    const fft_plan_t *fft = NULL;
+
+    if (fft_buffer && (!packed || spectrum))
+        fft = fft_plan(seg_size, fft_buffer, packed ? spectrum : stage->segments_ir);
+
+    if (fft) {
+        // the inverse transform is unnormalized, fold the 1/N scaling into the IR spectra
+        const float scale = 1.0f / seg_size;
+
+        for (uint32_t i = 0; i < stage->seg_count; i++) {
+            const uint32_t offset = i * block_size;
+            const uint32_t len = offset < ir_len ? min_u32(block_size, ir_len - offset) : 0;
+
+            for (uint32_t j = 0; j < len; j++)
+                fft_buffer[j] = ir[offset + j] * scale;
+            memset(fft_buffer + len, 0, (seg_size - len) * sizeof(float));
+
+            if (packed) {
+                fft_forward(fft, fft_buffer, spectrum);
+                kernel_stage_pack(stage, i, spectrum);
+            } else {
+                fft_forward(fft, fft_buffer, stage->segments_ir + i * stage->complex_stride);
+            }
+        }
+    }
+
+    fft_plan_release(fft);
+    fft_free(fft_buffer);
+    fft_free(spectrum);
+
+    return fft != NULL;
+}
+
+/**
+   Point the stages set up by kernel_size() into @p store, returns the end of
+   the used part of the store.
+*/
+static char * kernel_place(kernel_t *kernel, char *store)
+{
+    for (int i = 0; i < 3; i++) {
+        kernel_stage_t *stage = kernel_stage(kernel, i);
+
+        if (stage->seg_count > 0) {
+            const size_t values = (size_t)stage->complex_stride * stage->seg_count;
+
+            if (stage->format == KERNEL_FORMAT_FLOAT) {
+                stage->segments_ir = (fft_complex*) store;
+            } else {
+                stage->segments_packed = (uint16_t*) store;
+                stage->scales = (float*) (store + 2 * sizeof(uint16_t) * values);
+            }
+            store += stage_store_size(stage);
+        }
+    }
+
+    return store;
+}
+
+/**
+   Transform the stages set up by kernel_size() into @p store, returns the
+   end of the used part of the store or NULL on failure.
+*/
+static char * kernel_transform(kernel_t *kernel, const float *ir, uint32_t ir_len, char *store)
+{
+    uint32_t lens[3];
+    layout_split(&kernel->layout, ir_len, lens);
+
+    // padding stays zero, so stores are the same for the same IR
+    char *end = kernel_place(kernel, store);
+    memset(store, 0, end - store);
+
+    uint32_t offset = 0;
+
+    for (int i = 0; i < 3; i++) {
+        if (!kernel_stage_transform(kernel_stage(kernel, i), ir + offset, lens[i]))
+            return NULL;
+
+        offset += lens[i];
+    }
+
+    return end;
+}
+
+/**
+   Split an IR into the stages of a layout and transform every partition.
+
+   The layout is used as is, stages the IR is too short for stay empty.  All
+   spectra are kept in one allocation, in the given format.
+*/
+kernel_t * kernel_new(const float *ir, uint32_t ir_len, const engine_layout_t *layout, kernel_format_t format)
+{
+    kernel_t *kernel = (kernel_t*) malloc(sizeof(kernel_t));
+    if (!kernel)
+        return NULL;
+
+    const size_t size = kernel_size(kernel, ir, ir_len, layout, format);
+
+    if (size > 0) {
+        kernel->store = fft_malloc(size);
+
+        if (!kernel->store || !kernel_transform(kernel, ir, ir_len, (char*) kernel->store)) {
+            kernel_free(kernel);
+            return NULL;
+        }
+    }
+
+    return kernel;
+}
+
+/**
+   Create a float kernel on spectra prepared earlier, the kernel_store_size()
+   bytes of the store of a kernel_new() kernel with the same IR and layout.
+
+   Nothing is transformed and the store is not copied, it must stay valid and
+   unchanged while the kernel is used.  Fails if the size does not match.
+*/
+kernel_t * kernel_new_prepared(const float *ir, uint32_t ir_len, const engine_layout_t *layout, const void *store, size_t store_size)
+{
+    kernel_t *kernel = (kernel_t*) malloc(sizeof(kernel_t));
+    if (!kernel)
+        return NULL;
+
+    if (kernel_size(kernel, ir, ir_len, layout, KERNEL_FORMAT_FLOAT) != store_size) {
+        free(kernel);
+        return NULL;
+    }
+
+    kernel_place(kernel, (char*) store);
+
+    return kernel;
+}
+
+/**
+   Bytes of IR spectra in @p kernel.
+*/
+size_t kernel_store_size(const kernel_t *kernel)
+{
+    return stage_store_size(&kernel->head) + stage_store_size(&kernel->tail0) + stage_store_size(&kernel->tail);
+}
+
+void kernel_free(kernel_t *kernel)
+{
+    if (!kernel)
+        return;
+
+    fft_free(kernel->store);
+    free(kernel);
+}
+
+/**
+   Create a kernel that holds a mix of the float kernels @p a and @p b, set
+   with kernel_morph().  Both need the layout of the morph kernel, its
+   stages have as many partitions as the longer of the two.  Starts silent.
+*/
+kernel_t * kernel_new_morph(const kernel_t *a, const kernel_t *b)
+{
+    const engine_layout_t *layout = &a->layout;
+
+    if (layout->block_size != b->layout.block_size
+        || layout->head_block_size != b->layout.head_block_size
+        || layout->tail_block_size != b->layout.tail_block_size
+        || a->head.format != KERNEL_FORMAT_FLOAT || b->head.format != KERNEL_FORMAT_FLOAT)
+        return NULL;
+
+    kernel_t *kernel = (kernel_t*) calloc(1, sizeof(kernel_t));
+    if (!kernel)
+        return NULL;
+
+    kernel->layout = *layout;
+
+    size_t size = 0;
+    for (int i = 0; i < 3; i++) {
+        const kernel_stage_t *stage_a = kernel_stage((kernel_t*) a, i);
+        const kernel_stage_t *stage_b = kernel_stage((kernel_t*) b, i);
+        kernel_stage_t *stage = kernel_stage(kernel, i);
+
+        stage->block_size = stage_a->block_size;
+        stage->complex_stride = stage_a->complex_stride;
+        stage->seg_count = stage_a->seg_count > stage_b->seg_count ? stage_a->seg_count : stage_b->seg_count;
+        stage->format = KERNEL_FORMAT_FLOAT;
+
+        size += stage_store_size(stage);
+    }
+
+    if (size > 0) {
+        kernel->store = fft_malloc(size);
+        if (!kernel->store) {
+            free(kernel);
+            return NULL;
+        }
+        memset(kernel->store, 0, size);
+        kernel_place(kernel, (char*) kernel->store);
+    }
+
+    return kernel;
+}
+
+/**
+   Number of complex values kernel_morph() goes through.
+*/
+size_t kernel_morph_length(const kernel_t *morph)
+{
+    return (size_t)morph->head.complex_stride * morph->head.seg_count
+         + (size_t)morph->tail0.complex_stride * morph->tail0.seg_count
+         + (size_t)morph->tail.complex_stride * morph->tail.seg_count;
+}
+
+// values [start, end) of a stage mixed from stages that may be shorter
+static void stage_morph(kernel_stage_t *stage, const kernel_stage_t *a, const kernel_stage_t *b,
+                        float amount, size_t start, size_t end)
+{
+    const size_t len_a = (size_t)a->complex_stride * a->seg_count;
+    const size_t len_b = (size_t)b->complex_stride * b->seg_count;
+    const size_t len_both = len_a < len_b ? len_a : len_b;
+    fft_complex *out = stage->segments_ir;
+    size_t i = start;
+
+    for (; i < end && i < len_both; i++) {
+        out[i][REAL] = a->segments_ir[i][REAL] + amount * (b->segments_ir[i][REAL] - a->segments_ir[i][REAL]);
+        out[i][IMAG] = a->segments_ir[i][IMAG] + amount * (b->segments_ir[i][IMAG] - a->segments_ir[i][IMAG]);
+    }
+    for (; i < end && i < len_a; i++) {
+        out[i][REAL] = (1.0f - amount) * a->segments_ir[i][REAL];
+        out[i][IMAG] = (1.0f - amount) * a->segments_ir[i][IMAG];
+    }
+    for (; i < end && i < len_b; i++) {
+        out[i][REAL] = amount * b->segments_ir[i][REAL];
+        out[i][IMAG] = amount * b->segments_ir[i][IMAG];
+    }
+}
+
+/**
+   Set @p count complex values of @p morph, from @p position on, to the
+   linear interpolation between @p a at amount 0 and @p b at amount 1.
+   Returns the position to continue from, which wraps around at
+   kernel_morph_length().
+
+   Updating a morph kernel in steps keeps the cost per call bounded, an
+   engine can use it meanwhile.  Does not allocate.
+*/
+size_t kernel_morph(kernel_t *morph, const kernel_t *a, const kernel_t *b, float amount, size_t position, size_t count)
+{
+    const size_t length = kernel_morph_length(morph);
+    if (length == 0)
+        return 0;
+
+    while (count > 0) {
+        position %= length;
+
+        // find the stage of the position
+        size_t start = position;
+        int i = 0;
+        for (; i < 2; i++) {
+            const kernel_stage_t *stage = kernel_stage(morph, i);
+            const size_t stage_length = (size_t)stage->complex_stride * stage->seg_count;
+            if (start < stage_length)
+                break;
+            start -= stage_length;
+        }
+
+        kernel_stage_t *stage = kernel_stage(morph, i);
+        const size_t stage_length = (size_t)stage->complex_stride * stage->seg_count;
+        const size_t end = start + count < stage_length ? start + count : stage_length;
+
+        stage_morph(stage, kernel_stage((kernel_t*) a, i), kernel_stage((kernel_t*) b, i), amount, start, end);
+
+        position += end - start;
+        count -= end - start;
+    }
+
+    return position % length;
+}
+
+/**
+   Prepare kernels for several IRs with one layout.
+
+   The spectra of all kernels are packed into a single allocation, and the
+   kernels stay valid until the bank is freed.
+*/
+kernel_bank_t * kernel_bank_new(const float *const *irs, const uint32_t *ir_lens, uint32_t count, const engine_layout_t *layout, kernel_format_t format)
+{
+    kernel_bank_t *bank = (kernel_bank_t*) calloc(1, sizeof(kernel_bank_t));
+    if (!bank)
+        return NULL;
+
+    bank->layout = *layout;
+    bank->count = count;
+    bank->kernels = (kernel_t*) calloc(count ? count : 1, sizeof(kernel_t));
+
+    if (!bank->kernels)
+        goto fail;
+
+    size_t size = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        size += kernel_size(&bank->kernels[i], irs[i], ir_lens[i], layout, format);
+
+        if (ir_lens[i] > bank->max_ir_len)
+            bank->max_ir_len = ir_lens[i];
+    }
+
+    bank->store_size = size;
+
+    if (size > 0) {
+        bank->store = fft_malloc(bank->store_size);
+        if (!bank->store)
+            goto fail;
+
+        char *store = (char*) bank->store;
+        for (uint32_t i = 0; i < count && store; i++)
+            store = kernel_transform(&bank->kernels[i], irs[i], ir_lens[i], store);
+
+        if (!store)
+            goto fail;
+    }
+
+    return bank;
+
+fail:
+    kernel_bank_free(bank);
+    return NULL;
+}
+
+void kernel_bank_free(kernel_bank_t *bank)
+{
+    if (!bank)
+        return;
+
+    fft_free(bank->store);
+    free(bank->kernels);
+    free(bank);
+}
+
+// ----------------------------------------------------------------------------
+// Uniformly partitioned convolver
+
+bool convolver_scratch_init(convolver_scratch_t *scratch, uint32_t block_size)
+{
+    scratch->seg_size = 2 * block_size;
+    scratch->fft_buffer = (float*) fft_malloc(sizeof(float) * scratch->seg_size);
+    scratch->conv = (fft_complex*) fft_malloc(sizeof(fft_complex) * complex_stride(block_size));
+
+    if (!scratch->fft_buffer || !scratch->conv) {
+        convolver_scratch_free(scratch);
+        return false;
+    }
+
+    return true;
+}
+
+void convolver_scratch_free(convolver_scratch_t *scratch)
+{
+    fft_free(scratch->fft_buffer);
+    fft_free(scratch->conv);
+
+    memset(scratch, 0, sizeof(convolver_scratch_t));
+}
+
+/**
+   Set up a convolver for IRs of up to max_ir_len frames.
+
+   The plans are made on @p scratch, any scratch at least as large can be
+   used for processing.
+*/
+bool convolver_init(convolver_t *conv, uint32_t block_size, uint32_t max_ir_len, convolver_scratch_t *scratch)
+{
+    memset(conv, 0, sizeof(convolver_t));
+
+    if (max_ir_len == 0)
+        return true;
+
+    conv->block_size = block_size;
+    conv->seg_size = 2 * block_size;
+    conv->seg_count = (max_ir_len + block_size - 1) / block_size;
+    conv->complex_size = block_size + 1;
+    conv->complex_stride = complex_stride(block_size);
+
+    conv->segments = (fft_complex*) fft_malloc(sizeof(fft_complex) * conv->complex_stride * conv->seg_count);
+    conv->pre_multiplied = (fft_complex*) fft_malloc(sizeof(fft_complex) * conv->complex_stride);
+    conv->overlap = (float*) calloc(block_size, sizeof(float));
+    conv->input_buffer = (float*) calloc(block_size, sizeof(float));
+
+    if (!conv->segments || !conv->pre_multiplied || !conv->overlap || !conv->input_buffer)
+        goto fail;
+
+    conv->fft = fft_plan(conv->seg_size, scratch->fft_buffer, conv->segments);
+
+    if (!conv->fft)
+        goto fail;
+
+    convolver_reset(conv);
+
+    return true;
+
+fail:
+    convolver_free(conv);
+    return false;
+}
+
+void convolver_free(convolver_t *conv)
+{
+    fft_plan_release(conv->fft);
+    fft_free(conv->segments);
+    fft_free(conv->pre_multiplied);
+    free(conv->overlap);
+    free(conv->input_buffer);
+
+    memset(conv, 0, sizeof(convolver_t));
+}
+
+/**
+   Use the IR spectra of @p kernel from the next processed frame on.
+
+   The input state does not depend on the IR, so the output switches to the
+   new IR right away.  Fails if the kernel has a different partition size or
+   more partitions than the convolver was set up for.  A NULL kernel outputs
+   silence but keeps the input state up to date.
+*/
+bool convolver_set_kernel(convolver_t *conv, const kernel_stage_t *kernel)
+{
+    if (kernel && kernel->seg_count > 0 && (kernel->block_size != conv->block_size || kernel->seg_count > conv->seg_count))
+        return false;
+
+    conv->kernel = kernel;
+    conv->kernel_changed = true;
+
+    return true;
+}
+
+void convolver_reset(convolver_t *conv)
+{
+    if (conv->seg_count == 0)
+        return;
+
+    memset(conv->segments, 0, sizeof(fft_complex) * conv->complex_stride * conv->seg_count);
+    memset(conv->overlap, 0, sizeof(float) * conv->block_size);
+    memset(conv->input_buffer, 0, sizeof(float) * conv->block_size);
+
+    conv->input_buffer_fill = 0;
+    conv->current = 0;
+}
+
+void convolver_process(convolver_t *conv, convolver_scratch_t *scratch, const float *input, float *output, uint32_t len)
+{
+    if (conv->seg_count == 0) {
+        memset(output, 0, sizeof(float) * len);
+        return;
+    }
+
+    // without IR segments the input is still transformed, a later kernel may need it
+    const uint32_t kernel_segs = conv->kernel ? conv->kernel->seg_count : 0;
+
+    const uint32_t block_size = conv->block_size;
+    const uint32_t stride = conv->complex_stride;
+    float *fft_buffer = scratch->fft_buffer;
+    fft_complex *conv_buffer = scratch->conv;
+    uint32_t processed = 0;
+
+    while (processed < len) {
+        const bool input_buffer_was_empty = (conv->input_buffer_fill == 0);
+        const uint32_t processing = min_u32(len - processed, block_size - conv->input_buffer_fill);
+        const uint32_t input_buffer_pos = conv->input_buffer_fill;
+
+        memcpy(conv->input_buffer + input_buffer_pos, input + processed, sizeof(float) * processing);
+
+        // forward FFT of the (partially filled) current segment
+        memcpy(fft_buffer, conv->input_buffer, sizeof(float) * block_size);
+        memset(fft_buffer + block_size, 0, sizeof(float) * block_size);
+        fft_forward(conv->fft, fft_buffer, conv->segments + conv->current * stride);
+
+        // the older segments do not change until the current one is complete
+        if (input_buffer_was_empty || conv->kernel_changed) {
+            memset(conv->pre_multiplied, 0, sizeof(fft_complex) * conv->complex_size);
+
+            for (uint32_t i = 1; i < kernel_segs; i++) {
+                const uint32_t index_audio = (conv->current + i) % conv->seg_count;
+                kernel_multiply_accumulate(conv->pre_multiplied, conv->kernel, i,
+                        conv->segments + index_audio * stride,
+                        conv->complex_size);
+            }
+
+            conv->kernel_changed = false;
+        }
+
+        if (kernel_segs > 0) {
+            memcpy(conv_buffer, conv->pre_multiplied, sizeof(fft_complex) * conv->complex_size);
+            kernel_multiply_accumulate(conv_buffer, conv->kernel, 0,
+                    conv->segments + conv->current * stride,
+                    conv->complex_size);
+
+            fft_inverse(conv->fft, conv_buffer, fft_buffer);
+        } else {
+            memset(fft_buffer, 0, sizeof(float) * conv->seg_size);
+        }
+
+        for (uint32_t j = 0; j < processing; j++)
+            output[processed + j] = fft_buffer[input_buffer_pos + j] + conv->overlap[input_buffer_pos + j];
+
+        conv->input_buffer_fill += processing;
+
+        if (conv->input_buffer_fill == block_size) {
+            memset(conv->input_buffer, 0, sizeof(float) * block_size);
+            conv->input_buffer_fill = 0;
+
+            memcpy(conv->overlap, fft_buffer + block_size, sizeof(float) * block_size);
+
+            conv->current = (conv->current > 0) ? (conv->current - 1) : (conv->seg_count - 1);
+        }
+
+        processed += processing;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Engine layout
+
+/**
+   Layout with a bounded cost for every block: the head partitions follow the
+   latency mode and a tail is only added once the IR is longer than the head
+   and first tail stage.
+*/
+void engine_layout_realtime(engine_layout_t *layout, uint32_t block_size, uint32_t partition_multiplier, uint32_t ir_len)
+{
+    layout->block_size = block_size;
+    layout->head_block_size = block_size * partition_multiplier;
+    layout->tail_block_size = layout->head_block_size * TAIL_BLOCK_FACTOR;
+
+    if (ir_len <= 2 * layout->tail_block_size)
+        layout->tail_block_size = 0;
+}
+
+/**
+   Layout with the lowest cost per sample and the same latency as the
+   realtime layout, for freewheeling where the cost of a single block does
+   not matter.
+*/
+void engine_layout_throughput(engine_layout_t *layout, uint32_t block_size, uint32_t partition_multiplier, uint32_t ir_len)
+{
+    layout->block_size = block_size;
+    layout->head_block_size = block_size * partition_multiplier;
+    layout->tail_block_size = 0;
+
+    engine_layout_t candidate = *layout;
+    float best_cost = engine_layout_cost(layout, ir_len);
+
+    for (candidate.tail_block_size = 2 * layout->head_block_size;
+         2 * candidate.tail_block_size < ir_len;
+         candidate.tail_block_size *= 2) {
+        const float cost = engine_layout_cost(&candidate, ir_len);
+        if (cost < best_cost) {
+            best_cost = cost;
+            *layout = candidate;
+        }
+    }
+}
+
+// estimated operations per sample of a uniform stage, called once per partition
+static float stage_cost(uint32_t partition_size, uint32_t ir_len)
+{
+    if (ir_len == 0)
+        return 0.0f;
+
+    const float fft_size = 2.0f * partition_size;
+    const float partitions = (float)((ir_len + partition_size - 1) / partition_size);
+    // forward and inverse real FFT, and a complex multiply-accumulate per partition
+    const float fft_ops = 2.0f * 2.5f * fft_size * log2f(fft_size);
+    const float mac_ops = partitions * 8.0f * (partition_size + 1);
+
+    return (fft_ops + mac_ops) / partition_size;
+}
+
+float engine_layout_cost(const engine_layout_t *layout, uint32_t ir_len)
+{
+    const uint32_t head_size = layout->head_block_size;
+    const uint32_t tail_size = layout->tail_block_size;
+
+    if (tail_size == 0)
+        return stage_cost(head_size, ir_len);
+
+    return stage_cost(head_size, tail_size)
+         + stage_cost(head_size, tail_size)
+         + stage_cost(tail_size, ir_len - 2 * tail_size);
+}
+
+// block cost of @p layout with a kernel of @p ir, the mean and the peak over
+// a number of blocks, in seconds
+static bool layout_measure(const engine_layout_t *layout, const float *ir, uint32_t ir_len, double *mean, double *peak)
+{
+    const uint32_t block_size = layout->block_size;
+    const uint32_t period = layout->tail_block_size ? layout->tail_block_size : layout->head_block_size;
+    const uint32_t blocks = (TUNE_FRAMES > 4 * period ? TUNE_FRAMES : 4 * period) / block_size;
+
+    kernel_t *kernel = kernel_new(ir, ir_len, layout, KERNEL_FORMAT_FLOAT);
+    engine_t *engine = engine_new(layout, ir_len);
+    float *input = (float*) malloc(sizeof(float) * block_size);
+    float *output = (float*) malloc(sizeof(float) * block_size);
+    if (!kernel || !engine || !input || !output || !engine_set_kernel(engine, kernel)) {
+        engine_free(engine);
+        kernel_free(kernel);
+        free(input);
+        free(output);
+        return false;
+    }
+
+    uint32_t seed = 1;
+    for (uint32_t i = 0; i < block_size; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        input[i] = (float)(seed >> 8) / (float)(1u << 23) - 1.0f;
+    }
+
+    *mean = INFINITY;
+    *peak = INFINITY;
+
+    // the first run warms up caches, the best of the others counts
+    for (int run = 0; run < TUNE_RUNS + 1; run++) {
+        uint64_t total = 0;
+        uint64_t longest = 0;
+        for (uint32_t i = 0; i < blocks; i++) {
+            const uint64_t start = monotonic_ns();
+            engine_process(engine, input, output, block_size);
+            const uint64_t elapsed = monotonic_ns() - start;
+            total += elapsed;
+            longest = elapsed > longest ? elapsed : longest;
+        }
+        if (run > 0) {
+            *mean = fmin(*mean, 1e-9 * total / blocks);
+            *peak = fmin(*peak, 1e-9 * longest);
+        }
+    }
+
+    engine_free(engine);
+    kernel_free(kernel);
+    free(input);
+    free(output);
+    return true;
+}
+
+/**
+   Choose the tail of @p layout by timing every candidate with the IR, the
+   block and head sizes are kept so the latency does not change.
+
+   Picks the lowest mean cost among the layouts whose longest block takes at
+   most @p budget seconds, or the one with the shortest longest block if none
+   does.  Returns false if no candidate could be timed.
+*/
+bool engine_layout_tune(engine_layout_t *layout, const float *ir, uint32_t ir_len, double budget)
+{
+    engine_layout_t candidate = *layout;
+    bool found = false;
+    bool fits = false;
+    double best_mean = 0.0;
+    double best_peak = 0.0;
+
+    // no tail, then tails from twice the head size while the IR is longer
+    // than the head and first tail stage
+    candidate.tail_block_size = 0;
+    do {
+        double mean, peak;
+        if (layout_measure(&candidate, ir, ir_len, &mean, &peak)) {
+            const bool candidate_fits = peak <= budget;
+            if (!found
+                || (candidate_fits && (!fits || mean < best_mean))
+                || (!candidate_fits && !fits && peak < best_peak)) {
+                *layout = candidate;
+                found = true;
+                fits = candidate_fits;
+                best_mean = mean;
+                best_peak = peak;
+            }
+        }
+
+        candidate.tail_block_size = candidate.tail_block_size
+            ? 2 * candidate.tail_block_size : 2 * layout->head_block_size;
+    } while (2 * candidate.tail_block_size < ir_len);
+
+    return found;
+}
+
+// ----------------------------------------------------------------------------
+// Engine
+
+/**
+   Create an engine for IRs of up to max_ir_len frames with @p layout.
+
+   The engine outputs silence until a kernel is set.
+*/
+engine_t * engine_new(const engine_layout_t *layout, uint32_t max_ir_len)
+{
+    engine_t *engine = (engine_t*) calloc(1, sizeof(engine_t));
+    if (!engine)
+        return NULL;
+
+    engine->block_size = layout->block_size;
+    engine->head_block_size = layout->head_block_size;
+    engine->tail_block_size = layout->tail_block_size;
+    engine->latency = engine->head_block_size - engine->block_size;
+
+    const uint32_t head_size = engine->head_block_size;
+    const uint32_t tail_size = engine->tail_block_size;
+
+    if (!convolver_scratch_init(&engine->scratch, tail_size > head_size ? tail_size : head_size))
+        goto fail;
+
+    if (tail_size == 0) {
+        if (!convolver_init(&engine->head, head_size, max_ir_len, &engine->scratch))
+            goto fail;
+    } else {
+        uint32_t lens[3];
+        layout_split(layout, max_ir_len, lens);
+
+        if (!convolver_init(&engine->head, head_size, lens[0], &engine->scratch)
+            || !convolver_init(&engine->tail0, head_size, lens[1], &engine->scratch)
+            || !convolver_init(&engine->tail, tail_size, lens[2], &engine->scratch))
+            goto fail;
+
+        engine->tail_input = (float*) calloc(tail_size, sizeof(float));
+        engine->tail_output0 = (float*) calloc(tail_size, sizeof(float));
+        engine->tail_precalculated0 = (float*) calloc(tail_size, sizeof(float));
+        engine->tail_output = (float*) calloc(tail_size, sizeof(float));
+        engine->tail_precalculated = (float*) calloc(tail_size, sizeof(float));
+        engine->background_input = (float*) calloc(tail_size, sizeof(float));
+
+        if (!engine->tail_input || !engine->tail_output0 || !engine->tail_precalculated0
+            || !engine->tail_output || !engine->tail_precalculated || !engine->background_input)
+            goto fail;
+    }
+
+    if (engine->latency > 0) {
+        // output FIFO holds the latency plus one complete head partition
+        uint32_t fifo_size = 1;
+        while (fifo_size < engine->latency + head_size)
+            fifo_size <<= 1;
+
+        engine->fifo_input = (float*) calloc(head_size, sizeof(float));
+        engine->fifo_scratch = (float*) calloc(head_size, sizeof(float));
+        engine->fifo_output = (float*) calloc(fifo_size, sizeof(float));
+        engine->fifo_mask = fifo_size - 1;
+
+        if (!engine->fifo_input || !engine->fifo_scratch || !engine->fifo_output)
+            goto fail;
+    }
+
+    engine_reset(engine);
+
+    return engine;
+
+fail:
+    engine_free(engine);
+    return NULL;
+}
+
+static bool helper_attached(const engine_t *engine);
+
+/**
+   Convolve with @p kernel from now on, without allocating.
+
+   The kernel must have the layout of the engine and fit the IR length it was
+   created for.  Output of the tail stages computed before the switch still
+   uses the previous kernel, see engine_kernel_delay().  Without a kernel the engine outputs silence,
+   but keeps following the input at the cost of the forward transforms, so a
+   kernel can be set again at any time.
+*/
+bool engine_set_kernel(engine_t *engine, const kernel_t *kernel)
+{
+    if (!kernel) {
+        convolver_set_kernel(&engine->head, NULL);
+        convolver_set_kernel(&engine->tail0, NULL);
+        if (!helper_attached(engine))
+            convolver_set_kernel(&engine->tail, NULL);
+        engine->kernel = NULL;
+        return true;
+    }
+
+    const engine_layout_t *layout = &kernel->layout;
+
+    if (layout->block_size != engine->block_size
+        || layout->head_block_size != engine->head_block_size
+        || layout->tail_block_size != engine->tail_block_size)
+        return false;
+
+    if (kernel->head.seg_count > engine->head.seg_count
+        || kernel->tail0.seg_count > engine->tail0.seg_count
+        || kernel->tail.seg_count > engine->tail.seg_count)
+        return false;
+
+    convolver_set_kernel(&engine->head, &kernel->head);
+    convolver_set_kernel(&engine->tail0, &kernel->tail0);
+    // the helper owns the tail convolver, it gets the kernel with its next job
+    if (!helper_attached(engine))
+        convolver_set_kernel(&engine->tail, &kernel->tail);
+    engine->kernel = kernel;
+
+    return true;
+}
+
+/**
+   Frames the engine outputs after engine_set_kernel() before its output is
+   from the new kernel alone: the output FIFO, the head overlap, and the tail
+   blocks computed ahead along with the overlap of the last one.
+*/
+uint32_t engine_kernel_delay(const engine_t *engine)
+{
+    return engine->latency + engine->head_block_size + 3 * engine->tail_block_size;
+}
+
+// ----------------------------------------------------------------------------
+// Tail helper thread
+
+/**
+   Runs the tail convolver of an engine on its own thread.
+
+   The audio thread submits one job per tail block and collects its result a
+   tail block later.  Jobs alternate between two pre-allocated slots, the
+   submitted and completed counters are the only shared state.  A job can
+   carry a tail block that could not be submitted before, and can reset the
+   tail convolver first, so the convolver never gets out of step with the
+   input.
+*/
+typedef struct ENGINE_HELPER_T {
+    engine_t *engine;
+    pthread_t thread;
+    sem_t wake;
+    bool quit;
+
+    convolver_scratch_t scratch;
+    float *input[2];     // room for two tail blocks each
+    float *output[2];
+    const kernel_stage_t *kernel[2];
+    uint32_t blocks[2];  // tail blocks in the input of the job
+    bool reset[2];       // reset the tail convolver before the job
+
+    uint32_t submitted;  // written by the audio thread
+    uint32_t completed;  // written by the helper
+
+    // audio thread only
+    bool attached;       // the helper processes the tail, see engine_attach_helper()
+    uint32_t reset_at;   // submitted at the last reset
+    bool dropped;        // last tail block was not submitted
+    float *held;         // a tail block that was not submitted
+    bool holding;
+    bool resync;         // the next job resets the tail convolver
+
+    uint64_t deadline_ns;
+    uint32_t misses;
+} engine_helper_t;
+
+static void * helper_thread(void *arg)
+{
+    engine_helper_t *helper = (engine_helper_t*) arg;
+    engine_t *engine = helper->engine;
+
+    for (;;) {
+        sem_wait(&helper->wake);
+
+        if (__atomic_load_n(&helper->quit, __ATOMIC_ACQUIRE))
+            break;
+
+        uint32_t completed = helper->completed;
+        while (completed != __atomic_load_n(&helper->submitted, __ATOMIC_ACQUIRE)) {
+            const uint32_t slot = completed & 1;
+
+            if (engine->tail.kernel != helper->kernel[slot])
+                convolver_set_kernel(&engine->tail, helper->kernel[slot]);
+            if (helper->reset[slot])
+                convolver_reset(&engine->tail);
+
+            // only the output of the last block is collected
+            for (uint32_t i = 0; i < helper->blocks[slot]; i++)
+                convolver_process(&engine->tail, &helper->scratch,
+                        helper->input[slot] + i * engine->tail_block_size,
+                        helper->output[slot], engine->tail_block_size);
+
+            __atomic_store_n(&helper->completed, ++completed, __ATOMIC_RELEASE);
+        }
+    }
+
+    return NULL;
+}
+
+// wait for the helper to complete up to job @p count, until @p deadline_ns
+static bool helper_wait(engine_helper_t *helper, uint32_t count, uint64_t deadline_ns)
+{
+    uint64_t start = 0;
+
+    // the counters only grow, the difference is safe against wrap around
+    while ((int32_t)(count - __atomic_load_n(&helper->completed, __ATOMIC_ACQUIRE)) > 0) {
+        const uint64_t now = monotonic_ns();
+        if (start == 0)
+            start = now;
+        else if (now - start > deadline_ns)
+            return false;
+
+        sched_yield();
+    }
+
+    return true;
+}
+
+static void helper_free(engine_helper_t *helper)
+{
+    for (int i = 0; i < 2; i++) {
+        free(helper->input[i]);
+        free(helper->output[i]);
+    }
+    free(helper->held);
+    convolver_scratch_free(&helper->scratch);
+    free(helper);
+}
+
+/**
+   Move the tail stage of @p engine to a helper thread.
+
+   Tail blocks are only needed a whole tail block after they were submitted,
+   so this adds no latency.  At every tail block the audio thread waits up to
+   deadline_ns for the previous result.  If the helper misses it, that tail
+   block is left out of the output instead of stalling the audio thread.
+
+   The engine keeps processing the tail itself until engine_attach_helper(),
+   so it can be primed and caught up without waiting for the helper.  The
+   thread gets SCHED_FIFO with @p priority if that is positive and allowed,
+   else it runs with normal scheduling.  Returns false when the engine has no
+   tail or the thread could not be started.  Must not be called while the
+   engine is processing.
+*/
+bool engine_start_helper(engine_t *engine, int priority, uint64_t deadline_ns)
+{
+    if (engine->helper || !engine->tail_input || engine->tail.seg_count == 0)
+        return false;
+
+    engine_helper_t *helper = (engine_helper_t*) calloc(1, sizeof(engine_helper_t));
+    if (!helper)
+        return false;
+
+    const uint32_t tail_size = engine->tail_block_size;
+
+    helper->engine = engine;
+    helper->deadline_ns = deadline_ns;
+
+    helper->held = (float*) calloc(tail_size, sizeof(float));
+    bool ok = helper->held && convolver_scratch_init(&helper->scratch, tail_size);
+    for (int i = 0; i < 2 && ok; i++) {
+        helper->input[i] = (float*) calloc(2 * tail_size, sizeof(float));
+        helper->output[i] = (float*) calloc(tail_size, sizeof(float));
+        ok = helper->input[i] && helper->output[i];
+    }
+
+    if (!ok || sem_init(&helper->wake, 0, 0) != 0) {
+        helper_free(helper);
+        return false;
+    }
+
+    pthread_attr_t attr;
+    bool started = false;
+
+    if (priority > 0 && pthread_attr_init(&attr) == 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = priority;
+
+        if (pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED) == 0
+            && pthread_attr_setschedpolicy(&attr, SCHED_FIFO) == 0
+            && pthread_attr_setschedparam(&attr, &param) == 0)
+            started = pthread_create(&helper->thread, &attr, helper_thread, helper) == 0;
+
+        pthread_attr_destroy(&attr);
+    }
+
+    // realtime scheduling is not permitted everywhere
+    if (!started)
+        started = pthread_create(&helper->thread, NULL, helper_thread, helper) == 0;
+
+    if (!started) {
+        sem_destroy(&helper->wake);
+        helper_free(helper);
+        return false;
+    }
+
+    engine->helper = helper;
+
+    return true;
+}
+
+static void engine_stop_helper(engine_t *engine)
+{
+    engine_helper_t *helper = engine->helper;
+    if (!helper)
+        return;
+
+    __atomic_store_n(&helper->quit, true, __ATOMIC_RELEASE);
+    sem_post(&helper->wake);
+    pthread_join(helper->thread, NULL);
+    sem_destroy(&helper->wake);
+    helper_free(helper);
+
+    engine->helper = NULL;
+}
+
+/**
+   Let the helper started by engine_start_helper() process the tail from the
+   next tail block on.  Called from the thread that processes, neither blocks
+   nor allocates.
+*/
+void engine_attach_helper(engine_t *engine)
+{
+    engine_helper_t *helper = engine->helper;
+    if (!helper || helper->attached)
+        return;
+
+    // the first result is the one of the last tail block processed here
+    helper->attached = true;
+    helper->reset_at = helper->submitted;
+    helper->dropped = false;
+}
+
+static bool helper_attached(const engine_t *engine)
+{
+    return engine->helper && engine->helper->attached;
+}
+
+/**
+   Number of tail blocks the helper did not deliver in time.
+*/
+uint32_t engine_helper_misses(const engine_t *engine)
+{
+    return engine->helper ? __atomic_load_n(&engine->helper->misses, __ATOMIC_RELAXED) : 0;
+}
+
+// collect the previous tail block from the helper and submit the next one
+static void engine_helper_exchange(engine_t *engine)
+{
+    engine_helper_t *helper = engine->helper;
+    const uint32_t tail_size = engine->tail_block_size;
+    const uint32_t submitted = helper->submitted;
+
+    if (submitted == helper->reset_at && !helper->dropped) {
+        // the result of the last block processed before the helper started
+        float *swap = engine->tail_precalculated;
+        engine->tail_precalculated = engine->tail_output;
+        engine->tail_output = swap;
+    } else if (!helper->dropped && helper_wait(helper, submitted, helper->deadline_ns)) {
+        memcpy(engine->tail_precalculated, helper->output[(submitted - 1) & 1], sizeof(float) * tail_size);
+    } else {
+        memset(engine->tail_precalculated, 0, sizeof(float) * tail_size);
+        if (!helper->dropped)
+            __atomic_store_n(&helper->misses, helper->misses + 1, __ATOMIC_RELAXED);
+    }
+
+    // the slot is free once the job before the last one is done, else this
+    // tail block goes with the next job, or if one is held already the tail
+    // convolver starts over, so it stays aligned with the input
+    helper->dropped = !helper_wait(helper, submitted - 1, 0);
+    if (helper->dropped) {
+        __atomic_store_n(&helper->misses, helper->misses + 1, __ATOMIC_RELAXED);
+        if (helper->holding) {
+            helper->holding = false;
+            helper->resync = true;
+        } else {
+            memcpy(helper->held, engine->tail_input, sizeof(float) * tail_size);
+            helper->holding = true;
+        }
+        return;
+    }
+
+    const uint32_t slot = submitted & 1;
+    uint32_t blocks = 0;
+    if (helper->holding)
+        memcpy(helper->input[slot] + tail_size * blocks++, helper->held, sizeof(float) * tail_size);
+    memcpy(helper->input[slot] + tail_size * blocks++, engine->tail_input, sizeof(float) * tail_size);
+    helper->blocks[slot] = blocks;
+    helper->reset[slot] = helper->resync;
+    helper->kernel[slot] = engine->kernel ? &engine->kernel->tail : NULL;
+    helper->holding = false;
+    helper->resync = false;
+
+    __atomic_store_n(&helper->submitted, submitted + 1, __ATOMIC_RELEASE);
+    sem_post(&helper->wake);
+}
+
+/**
+   Number of input frames that must be fed to a new engine for its output to
+   match one that has been running all along.  A multiple of all partition
+   sizes, so the engine ends up aligned to its partitions.
+*/
+uint32_t engine_history_length(const engine_t *engine, uint32_t ir_len)
+{
+    const uint32_t partition = engine->tail_block_size > engine->head_block_size ?
+                               engine->tail_block_size : engine->head_block_size;
+    const uint32_t needed = ir_len + engine->latency;
+
+    return ((needed + partition - 1) / partition) * partition;
+}
+
+void engine_free(engine_t *engine)
+{
+    if (!engine)
+        return;
+
+    engine_stop_helper(engine);
+    convolver_free(&engine->head);
+    convolver_free(&engine->tail0);
+    convolver_free(&engine->tail);
+    convolver_scratch_free(&engine->scratch);
+    free(engine->tail_input);
+    free(engine->tail_output0);
+    free(engine->tail_precalculated0);
+    free(engine->tail_output);
+    free(engine->tail_precalculated);
+    free(engine->background_input);
+    free(engine->fifo_input);
+    free(engine->fifo_scratch);
+    free(engine->fifo_output);
+    free(engine);
+}
+
+void engine_reset(engine_t *engine)
+{
+    engine_helper_t *helper = engine->helper;
+    if (helper_attached(engine)) {
+        // the tail convolver is the helper's, its next job resets it
+        helper->reset_at = helper->submitted;
+        helper->dropped = false;
+        helper->holding = false;
+        helper->resync = true;
+    } else {
+        convolver_reset(&engine->tail);
+    }
+
+    convolver_reset(&engine->head);
+    convolver_reset(&engine->tail0);
+
+    if (engine->tail_input) {
+        const size_t tail_bytes = sizeof(float) * engine->tail_block_size;
+        memset(engine->tail_input, 0, tail_bytes);
+        memset(engine->tail_output0, 0, tail_bytes);
+        memset(engine->tail_precalculated0, 0, tail_bytes);
+        memset(engine->tail_output, 0, tail_bytes);
+        memset(engine->tail_precalculated, 0, tail_bytes);
+        memset(engine->background_input, 0, tail_bytes);
+    }
+    engine->tail_input_fill = 0;
+
+    if (engine->fifo_output) {
+        memset(engine->fifo_input, 0, sizeof(float) * engine->head_block_size);
+        memset(engine->fifo_output, 0, sizeof(float) * (engine->fifo_mask + 1));
+    }
+    engine->fifo_input_fill = 0;
+    engine->fifo_read = 0;
+    engine->fifo_write = engine->latency;
+}
+
+/**
+   Head and tail without latency, based on the two-stage scheme of
+   HiFi-LoFi's FFTConvolver.  The first tail stage runs in head sized steps
+   and is used one tail block later, the remaining tail runs once per tail
+   block and is used two tail blocks later.
+*/
+static void engine_process_stages(engine_t *engine, convolver_scratch_t *scratch, const float *input, float *output, uint32_t len)
+{
+    convolver_process(&engine->head, scratch, input, output, len);
+
+    if (!engine->tail_input)
+        return;
+
+    const uint32_t head_size = engine->head_block_size;
+    const uint32_t tail_size = engine->tail_block_size;
+    uint32_t processed = 0;
+
+    while (processed < len) {
+        const uint32_t processing = min_u32(len - processed, head_size - (engine->tail_input_fill % head_size));
+        const uint32_t sum_begin = engine->tail_input_fill;
+
+        memcpy(engine->tail_input + sum_begin, input + processed, sizeof(float) * processing);
+
+        for (uint32_t j = 0; j < processing; j++)
+            output[processed + j] += engine->tail_precalculated0[sum_begin + j] + engine->tail_precalculated[sum_begin + j];
+
+        engine->tail_input_fill += processing;
+
+        if (engine->tail_input_fill % head_size == 0) {
+            const uint32_t block_offset = engine->tail_input_fill - head_size;
+            convolver_process(&engine->tail0, scratch,
+                    engine->tail_input + block_offset,
+                    engine->tail_output0 + block_offset,
+                    head_size);
+        }
+
+        if (engine->tail_input_fill == tail_size) {
+            float *swap = engine->tail_precalculated0;
+            engine->tail_precalculated0 = engine->tail_output0;
+            engine->tail_output0 = swap;
+
+            if (helper_attached(engine)) {
+                engine_helper_exchange(engine);
+            } else {
+                swap = engine->tail_precalculated;
+                engine->tail_precalculated = engine->tail_output;
+                engine->tail_output = swap;
+
+                memcpy(engine->background_input, engine->tail_input, sizeof(float) * tail_size);
+                convolver_process(&engine->tail, scratch, engine->background_input, engine->tail_output, tail_size);
+            }
+
+            engine->tail_input_fill = 0;
+        }
+
+        processed += processing;
+    }
+}
+
+static void engine_process_scratch(engine_t *engine, convolver_scratch_t *scratch, const float *input, float *output, uint32_t len)
+{
+    if (engine->latency == 0) {
+        engine_process_stages(engine, scratch, input, output, len);
+        return;
+    }
+
+    const uint32_t head_size = engine->head_block_size;
+    const uint32_t mask = engine->fifo_mask;
+    uint32_t processed = 0;
+
+    while (processed < len) {
+        const uint32_t processing = min_u32(len - processed, head_size - engine->fifo_input_fill);
+
+        memcpy(engine->fifo_input + engine->fifo_input_fill, input + processed, sizeof(float) * processing);
+        engine->fifo_input_fill += processing;
+
+        if (engine->fifo_input_fill == head_size) {
+            engine_process_stages(engine, scratch, engine->fifo_input, engine->fifo_scratch, head_size);
+
+            for (uint32_t j = 0; j < head_size; j++)
+                engine->fifo_output[(engine->fifo_write + j) & mask] = engine->fifo_scratch[j];
+
+            engine->fifo_write += head_size;
+            engine->fifo_input_fill = 0;
+        }
+
+        // blocks smaller than the one the engine was built for can underrun
+        for (uint32_t j = 0; j < processing; j++) {
+            if (engine->fifo_read != engine->fifo_write) {
+                output[processed + j] = engine->fifo_output[engine->fifo_read & mask];
+                engine->fifo_read++;
+            } else {
+                output[processed + j] = 0.0f;
+            }
+        }
+
+        processed += processing;
+    }
+}
+
+void engine_process(engine_t *engine, const float *input, float *output, uint32_t len)
+{
+    engine_process_scratch(engine, &engine->scratch, input, output, len);
+}
+
+/**
+   Process several channels or instances in one call.
+
+   All engines work on the scratch of the first one where it is large enough,
+   so the FFT buffers stay in cache, and engines sharing a kernel run back to
+   back on the same IR spectra.
+*/
+void engine_process_batch(engine_t *const *engines, const float *const *inputs, float *const *outputs, uint32_t count, uint32_t len)
+{
+    if (count == 0)
+        return;
+
+    convolver_scratch_t *shared = &engines[0]->scratch;
+
+    for (uint32_t i = 0; i < count; i++) {
+        engine_t *engine = engines[i];
+        convolver_scratch_t *scratch = engine->scratch.seg_size <= shared->seg_size ? shared : &engine->scratch;
+
+        engine_process_scratch(engine, scratch, inputs[i], outputs[i], len);
+    }
+}
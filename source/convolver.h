@@ -0,0 +1,216 @@
+#ifndef CONVOLVER_H
+#define CONVOLVER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fft.h"
+
+// tail partitions are this many times larger than the head partitions
+#define TAIL_BLOCK_FACTOR 8
+
+/**
+   Partition layout of an engine.
+
+   The latency is head_block_size - block_size, a tail_block_size of 0 means
+   the head covers the whole IR.
+*/
+typedef struct ENGINE_LAYOUT_T {
+    uint32_t block_size;
+    uint32_t head_block_size;
+    uint32_t tail_block_size;
+} engine_layout_t;
+
+/**
+   Storage of the IR spectra in a kernel.
+
+   Half and int16 kernels take half the memory of float ones and are
+   expanded to float in the multiply-accumulate.  Half spectra have a scale
+   per partition, int16 spectra one per KERNEL_SCALE_BLOCK bins.
+*/
+typedef enum {
+    KERNEL_FORMAT_FLOAT,
+    KERNEL_FORMAT_HALF,
+    KERNEL_FORMAT_INT16
+} kernel_format_t;
+
+#define KERNEL_SCALE_BLOCK 8
+
+// selects the kernel format of the plugin, "float", "half" or "int16"
+#define KERNEL_FORMAT_ENV "CABSIM_KERNEL_FORMAT"
+
+/**
+   IR spectra of one uniformly partitioned stage.
+*/
+typedef struct KERNEL_STAGE_T {
+    uint32_t block_size;
+    uint32_t seg_count;
+    uint32_t complex_stride;
+    kernel_format_t format;
+
+    // float spectra, or the 16 bit real and imaginary parts and their scales
+    fft_complex *segments_ir;
+    uint16_t *segments_packed;
+    float *scales;
+} kernel_stage_t;
+
+/**
+   IR prepared for one partition layout.
+
+   Immutable once prepared, so any number of engines with the same layout can
+   use it at the same time.
+*/
+typedef struct KERNEL_T {
+    engine_layout_t layout;
+
+    kernel_stage_t head;
+    kernel_stage_t tail0;
+    kernel_stage_t tail;
+
+    // spectra of all stages, NULL for kernels in a bank or on prepared spectra
+    void *store;
+} kernel_t;
+
+/**
+   Kernels for a set of IRs with one layout, sharing one store.
+*/
+typedef struct KERNEL_BANK_T {
+    engine_layout_t layout;
+    uint32_t count;
+    uint32_t max_ir_len;
+
+    kernel_t *kernels;
+    void *store;
+    size_t store_size;
+} kernel_bank_t;
+
+/**
+   Work buffers of a convolver that do not carry state between calls, sized
+   for the largest partition of an engine.
+*/
+typedef struct CONVOLVER_SCRATCH_T {
+    uint32_t seg_size;
+
+    float *fft_buffer;
+    fft_complex *conv;
+} convolver_scratch_t;
+
+/**
+   Uniformly partitioned overlap-add convolver.
+
+   Has zero latency for any number of frames per call, but is cheapest when
+   called with exactly block_size frames.  Holds the spectra of the last
+   seg_count input segments, the IR spectra come from a kernel stage with at
+   most that many segments.
+*/
+typedef struct CONVOLVER_T {
+    uint32_t block_size;
+    uint32_t seg_size;
+    uint32_t seg_count;
+    uint32_t complex_size;
+    uint32_t complex_stride;
+
+    const kernel_stage_t *kernel;
+    bool kernel_changed;
+
+    fft_complex *segments;
+    fft_complex *pre_multiplied;
+
+    float *overlap;
+    float *input_buffer;
+
+    uint32_t input_buffer_fill;
+    uint32_t current;
+
+    const fft_plan_t *fft;
+} convolver_t;
+
+/**
+   Convolution engine for one partition layout.
+
+   The first part of the IR is handled by a head convolver with partitions of
+   head_block_size, long IRs can get an additional tail with partitions of
+   tail_block_size.  When latency is non-zero the head runs on whole
+   partitions fed from an input FIFO and the result is delayed by latency.
+
+   The engine only holds the input state, the IR comes from a kernel with the
+   same layout that must outlive its use by the engine.
+*/
+typedef struct ENGINE_T {
+    uint32_t block_size;
+    uint32_t head_block_size;
+    uint32_t tail_block_size;
+    uint32_t latency;
+
+    const kernel_t *kernel;
+    convolver_scratch_t scratch;
+
+    convolver_t head;
+    convolver_t tail0;
+    convolver_t tail;
+
+    float *tail_input;
+    uint32_t tail_input_fill;
+    float *tail_output0;
+    float *tail_precalculated0;
+    float *tail_output;
+    float *tail_precalculated;
+    float *background_input;
+
+    // runs the tail stage when started, see engine_start_helper()
+    struct ENGINE_HELPER_T *helper;
+
+    float *fifo_input;
+    uint32_t fifo_input_fill;
+    float *fifo_scratch;
+    float *fifo_output;
+    uint32_t fifo_mask;
+    uint32_t fifo_read;
+    uint32_t fifo_write;
+} engine_t;
+
+bool convolver_import_wisdom(const char *path);
+bool convolver_import_system_wisdom(void);
+
+bool convolver_scratch_init(convolver_scratch_t *scratch, uint32_t block_size);
+void convolver_scratch_free(convolver_scratch_t *scratch);
+
+bool convolver_init(convolver_t *conv, uint32_t block_size, uint32_t max_ir_len, convolver_scratch_t *scratch);
+void convolver_free(convolver_t *conv);
+bool convolver_set_kernel(convolver_t *conv, const kernel_stage_t *kernel);
+void convolver_reset(convolver_t *conv);
+void convolver_process(convolver_t *conv, convolver_scratch_t *scratch, const float *input, float *output, uint32_t len);
+
+void engine_layout_realtime(engine_layout_t *layout, uint32_t block_size, uint32_t partition_multiplier, uint32_t ir_len);
+void engine_layout_throughput(engine_layout_t *layout, uint32_t block_size, uint32_t partition_multiplier, uint32_t ir_len);
+float engine_layout_cost(const engine_layout_t *layout, uint32_t ir_len);
+bool engine_layout_tune(engine_layout_t *layout, const float *ir, uint32_t ir_len, double budget);
+
+bool kernel_format_parse(const char *name, kernel_format_t *format);
+const char * kernel_format_name(kernel_format_t format);
+
+kernel_t * kernel_new(const float *ir, uint32_t ir_len, const engine_layout_t *layout, kernel_format_t format);
+kernel_t * kernel_new_prepared(const float *ir, uint32_t ir_len, const engine_layout_t *layout, const void *store, size_t store_size);
+size_t kernel_store_size(const kernel_t *kernel);
+void kernel_free(kernel_t *kernel);
+
+kernel_t * kernel_new_morph(const kernel_t *a, const kernel_t *b);
+size_t kernel_morph_length(const kernel_t *morph);
+size_t kernel_morph(kernel_t *morph, const kernel_t *a, const kernel_t *b, float amount, size_t position, size_t count);
+
+kernel_bank_t * kernel_bank_new(const float *const *irs, const uint32_t *ir_lens, uint32_t count, const engine_layout_t *layout, kernel_format_t format);
+void kernel_bank_free(kernel_bank_t *bank);
+
+engine_t * engine_new(const engine_layout_t *layout, uint32_t max_ir_len);
+bool engine_set_kernel(engine_t *engine, const kernel_t *kernel);
+uint32_t engine_kernel_delay(const engine_t *engine);
+uint32_t engine_history_length(const engine_t *engine, uint32_t ir_len);
+void engine_free(engine_t *engine);
+bool engine_start_helper(engine_t *engine, int priority, uint64_t deadline_ns);
+void engine_attach_helper(engine_t *engine);
+uint32_t engine_helper_misses(const engine_t *engine);
+void engine_reset(engine_t *engine);
+void engine_process(engine_t *engine, const float *input, float *output, uint32_t len);
+void engine_process_batch(engine_t *const *engines, const float *const *inputs, float *const *outputs, uint32_t count, uint32_t len);
+
+#endif // CONVOLVER_H
@@ -0,0 +1,36 @@
+#ifndef DEFAULT_IR_H
+#define DEFAULT_IR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// IR of the default state, in the plugin bundle
+#define DEFAULT_IR_FILE "forward-audio_AliceInBones.wav"
+
+/**
+   Kernel spectra of the default IR for one partition layout, as
+   kernel_new() stores them.
+*/
+typedef struct {
+    uint32_t     head_block_size;
+    uint32_t     tail_block_size;
+    const float* store;
+    size_t       store_size;
+} DefaultKernel;
+
+/**
+   The default IR resampled to one sample rate, and its kernels.
+*/
+typedef struct {
+    int                  samplerate;
+    uint32_t             frames;
+    const float*         data;
+    const DefaultKernel* kernels;
+    uint32_t             kernel_count;
+} DefaultIR;
+
+// generated by cabsim-embed at build time
+extern const DefaultIR default_irs[];
+extern const uint32_t  default_ir_count;
+
+#endif // DEFAULT_IR_H
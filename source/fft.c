@@ -0,0 +1,726 @@
+#include "fft.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_FFTW
+#include "fftw3.h"
+#endif
+
+// four floats in SSE or NEON registers, loads and stores need not be aligned
+#if defined(__GNUC__) && !defined(FFT_NO_SIMD)
+#define FFT_SIMD
+typedef float v4sf __attribute__((vector_size(16), aligned(4), may_alias));
+#endif
+
+// the FFTW planner is not thread-safe, engines are built from several threads
+static pthread_mutex_t planner_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef HAVE_FFTW
+static bool wisdom_imported = false;
+static bool system_wisdom_tried = false;
+static bool system_wisdom_imported = false;
+
+typedef struct WISDOM_FILE_T {
+    struct WISDOM_FILE_T *next;
+    bool imported;
+    char path[];
+} wisdom_file_t;
+
+// files tried so far, every instance asks for the same ones
+static wisdom_file_t *wisdom_files = NULL;
+#endif
+
+/**
+   Forward and inverse real FFT of one size, with the backend chosen for it.
+
+   Plans hold no buffers, so one plan can run on several threads at once.
+*/
+struct FFT_PLAN_T {
+    struct FFT_PLAN_T *next;
+    uint32_t size;
+    int real_alignment;
+    int spectrum_alignment;
+    uint32_t refcount;
+
+    fft_backend_t backend;
+
+#ifdef HAVE_FFTW
+    fftwf_plan r2c;
+    fftwf_plan c2r;
+#endif
+
+    // built-in FFT, size / 2 complex points with the real FFT split around it
+    uint32_t half;
+    float *twiddle_re;
+    float *twiddle_im;
+    float *split_re;
+    float *split_im;
+};
+
+// plans shared by all engines of the process, keyed by size and alignment
+static fft_plan_t *plan_cache = NULL;
+
+static double monotonic_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool is_power_of_two(uint32_t size)
+{
+    return size && (size & (size - 1)) == 0;
+}
+
+static int alignment_of(const void *ptr)
+{
+    return (int)((uintptr_t)ptr % 16);
+}
+
+// ----------------------------------------------------------------------------
+// Wisdom and memory
+
+/**
+   Import FFTW wisdom from @p path, or the system wisdom if it is NULL.
+
+   Every file is only read once per process, later calls return whether it
+   was imported the first time.  Always fails without FFTW.
+*/
+bool fft_import_wisdom(const char *path)
+{
+#ifdef HAVE_FFTW
+    bool imported = false;
+
+    pthread_mutex_lock(&planner_lock);
+    if (!path) {
+        if (!system_wisdom_tried) {
+            system_wisdom_tried = true;
+            system_wisdom_imported = fftwf_import_system_wisdom() != 0;
+            wisdom_imported |= system_wisdom_imported;
+        }
+        imported = system_wisdom_imported;
+    } else {
+        wisdom_file_t *file;
+        for (file = wisdom_files; file; file = file->next) {
+            if (!strcmp(file->path, path))
+                break;
+        }
+        if (file) {
+            imported = file->imported;
+        } else {
+            imported = fftwf_import_wisdom_from_filename(path) != 0;
+            wisdom_imported |= imported;
+
+            file = (wisdom_file_t*) malloc(sizeof(wisdom_file_t) + strlen(path) + 1);
+            if (file) {
+                strcpy(file->path, path);
+                file->imported = imported;
+                file->next = wisdom_files;
+                wisdom_files = file;
+            }
+        }
+    }
+    pthread_mutex_unlock(&planner_lock);
+
+    return imported;
+#else
+    (void) path;
+    return false;
+#endif
+}
+
+void * fft_malloc(size_t size)
+{
+#ifdef HAVE_FFTW
+    return fftwf_malloc(size);
+#else
+    void *ptr = NULL;
+    if (posix_memalign(&ptr, 64, size ? size : 1))
+        return NULL;
+    return ptr;
+#endif
+}
+
+void fft_free(void *ptr)
+{
+#ifdef HAVE_FFTW
+    fftwf_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+bool fft_backend_available(fft_backend_t backend, uint32_t size)
+{
+    switch (backend) {
+    case FFT_BACKEND_FFTW:
+#ifdef HAVE_FFTW
+        return size >= 2 && size % 2 == 0;
+#else
+        return false;
+#endif
+    case FFT_BACKEND_BUILTIN:
+        return is_power_of_two(size) && size >= FFT_MIN_BUILTIN_SIZE;
+    default:
+        return fft_backend_available(FFT_BACKEND_FFTW, size)
+            || fft_backend_available(FFT_BACKEND_BUILTIN, size);
+    }
+}
+
+const char * fft_backend_name(fft_backend_t backend)
+{
+    switch (backend) {
+    case FFT_BACKEND_FFTW:
+        return "fftw";
+    case FFT_BACKEND_BUILTIN:
+        return "builtin";
+    default:
+        return "auto";
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Built-in FFT
+//
+// A real FFT of size N is a complex FFT of the N / 2 points formed by the
+// even and odd samples, split into the spectra of both halves afterwards.
+// The complex FFT is a radix-4 Stockham autosort FFT on separate real and
+// imaginary arrays, so every stage with a stride of four or more runs four
+// butterflies per vector operation and the result needs no bit reversal.
+
+static bool builtin_init(fft_plan_t *plan)
+{
+    const uint32_t half = plan->size / 2;
+
+    plan->half = half;
+    plan->twiddle_re = (float*) fft_malloc(sizeof(float) * (2 * half + 2 * (half + 1)));
+    if (!plan->twiddle_re)
+        return false;
+
+    plan->twiddle_im = plan->twiddle_re + half;
+    plan->split_re = plan->twiddle_im + half;
+    plan->split_im = plan->split_re + half + 1;
+
+    // exp(-2 pi i k / half) for the butterflies
+    for (uint32_t k = 0; k < half; k++) {
+        plan->twiddle_re[k] = (float) cos(2.0 * M_PI * k / half);
+        plan->twiddle_im[k] = (float) -sin(2.0 * M_PI * k / half);
+    }
+
+    // exp(-2 pi i k / size) to split the spectra of the even and odd samples
+    for (uint32_t k = 0; k <= half; k++) {
+        plan->split_re[k] = (float) cos(2.0 * M_PI * k / plan->size);
+        plan->split_im[k] = (float) -sin(2.0 * M_PI * k / plan->size);
+    }
+
+    return true;
+}
+
+/**
+   Stockham stage with m butterflies of stride s, from x to y.
+*/
+static void builtin_stage(const fft_plan_t *plan, uint32_t m, uint32_t s,
+                          const float *xr, const float *xi, float *yr, float *yi)
+{
+    for (uint32_t p = 0; p < m; p++) {
+        const float wr = plan->twiddle_re[p * s];
+        const float wi = plan->twiddle_im[p * s];
+
+        const float *ar = xr + s * p;
+        const float *ai = xi + s * p;
+        const float *br = xr + s * (p + m);
+        const float *bi = xi + s * (p + m);
+        float *sum_r = yr + s * 2 * p;
+        float *sum_i = yi + s * 2 * p;
+        float *dif_r = yr + s * (2 * p + 1);
+        float *dif_i = yi + s * (2 * p + 1);
+
+        uint32_t q = 0;
+#ifdef FFT_SIMD
+        const v4sf vwr = { wr, wr, wr, wr };
+        const v4sf vwi = { wi, wi, wi, wi };
+        for (; q + 4 <= s; q += 4) {
+            const v4sf var = *(const v4sf*)(ar + q);
+            const v4sf vai = *(const v4sf*)(ai + q);
+            const v4sf vbr = *(const v4sf*)(br + q);
+            const v4sf vbi = *(const v4sf*)(bi + q);
+            const v4sf dr = var - vbr;
+            const v4sf di = vai - vbi;
+            *(v4sf*)(sum_r + q) = var + vbr;
+            *(v4sf*)(sum_i + q) = vai + vbi;
+            *(v4sf*)(dif_r + q) = dr * vwr - di * vwi;
+            *(v4sf*)(dif_i + q) = dr * vwi + di * vwr;
+        }
+#endif
+        for (; q < s; q++) {
+            const float dr = ar[q] - br[q];
+            const float di = ai[q] - bi[q];
+            sum_r[q] = ar[q] + br[q];
+            sum_i[q] = ai[q] + bi[q];
+            dif_r[q] = dr * wr - di * wi;
+            dif_i[q] = dr * wi + di * wr;
+        }
+    }
+}
+
+/**
+   Radix-4 Stockham stage with m butterflies of stride s, from x to y, doing
+   the work of two radix-2 stages in one pass over the data.
+*/
+static void builtin_stage4(const fft_plan_t *plan, uint32_t m, uint32_t s,
+                           const float *xr, const float *xi, float *yr, float *yi)
+{
+    for (uint32_t p = 0; p < m; p++) {
+        const float w1r = plan->twiddle_re[p * s];
+        const float w1i = plan->twiddle_im[p * s];
+        const float w2r = plan->twiddle_re[2 * p * s];
+        const float w2i = plan->twiddle_im[2 * p * s];
+        const float w3r = plan->twiddle_re[3 * p * s];
+        const float w3i = plan->twiddle_im[3 * p * s];
+
+        const uint32_t a = s * p;
+        const uint32_t b = s * (p + m);
+        const uint32_t c = s * (p + 2 * m);
+        const uint32_t d = s * (p + 3 * m);
+        const uint32_t y0 = s * 4 * p;
+        const uint32_t y1 = y0 + s;
+        const uint32_t y2 = y1 + s;
+        const uint32_t y3 = y2 + s;
+
+        uint32_t q = 0;
+#ifdef FFT_SIMD
+        const v4sf v1r = { w1r, w1r, w1r, w1r };
+        const v4sf v1i = { w1i, w1i, w1i, w1i };
+        const v4sf v2r = { w2r, w2r, w2r, w2r };
+        const v4sf v2i = { w2i, w2i, w2i, w2i };
+        const v4sf v3r = { w3r, w3r, w3r, w3r };
+        const v4sf v3i = { w3i, w3i, w3i, w3i };
+        for (; q + 4 <= s; q += 4) {
+            const v4sf ar = *(const v4sf*)(xr + a + q);
+            const v4sf ai = *(const v4sf*)(xi + a + q);
+            const v4sf br = *(const v4sf*)(xr + b + q);
+            const v4sf bi = *(const v4sf*)(xi + b + q);
+            const v4sf cr = *(const v4sf*)(xr + c + q);
+            const v4sf ci = *(const v4sf*)(xi + c + q);
+            const v4sf dr = *(const v4sf*)(xr + d + q);
+            const v4sf di = *(const v4sf*)(xi + d + q);
+
+            const v4sf apc_r = ar + cr, apc_i = ai + ci;
+            const v4sf amc_r = ar - cr, amc_i = ai - ci;
+            const v4sf bpd_r = br + dr, bpd_i = bi + di;
+            // i * (b - d)
+            const v4sf jbmd_r = di - bi, jbmd_i = br - dr;
+
+            const v4sf t1r = amc_r - jbmd_r, t1i = amc_i - jbmd_i;
+            const v4sf t2r = apc_r - bpd_r, t2i = apc_i - bpd_i;
+            const v4sf t3r = amc_r + jbmd_r, t3i = amc_i + jbmd_i;
+
+            *(v4sf*)(yr + y0 + q) = apc_r + bpd_r;
+            *(v4sf*)(yi + y0 + q) = apc_i + bpd_i;
+            *(v4sf*)(yr + y1 + q) = t1r * v1r - t1i * v1i;
+            *(v4sf*)(yi + y1 + q) = t1r * v1i + t1i * v1r;
+            *(v4sf*)(yr + y2 + q) = t2r * v2r - t2i * v2i;
+            *(v4sf*)(yi + y2 + q) = t2r * v2i + t2i * v2r;
+            *(v4sf*)(yr + y3 + q) = t3r * v3r - t3i * v3i;
+            *(v4sf*)(yi + y3 + q) = t3r * v3i + t3i * v3r;
+        }
+#endif
+        for (; q < s; q++) {
+            const float apc_r = xr[a + q] + xr[c + q], apc_i = xi[a + q] + xi[c + q];
+            const float amc_r = xr[a + q] - xr[c + q], amc_i = xi[a + q] - xi[c + q];
+            const float bpd_r = xr[b + q] + xr[d + q], bpd_i = xi[b + q] + xi[d + q];
+            const float jbmd_r = xi[d + q] - xi[b + q], jbmd_i = xr[b + q] - xr[d + q];
+
+            const float t1r = amc_r - jbmd_r, t1i = amc_i - jbmd_i;
+            const float t2r = apc_r - bpd_r, t2i = apc_i - bpd_i;
+            const float t3r = amc_r + jbmd_r, t3i = amc_i + jbmd_i;
+
+            yr[y0 + q] = apc_r + bpd_r;
+            yi[y0 + q] = apc_i + bpd_i;
+            yr[y1 + q] = t1r * w1r - t1i * w1i;
+            yi[y1 + q] = t1r * w1i + t1i * w1r;
+            yr[y2 + q] = t2r * w2r - t2i * w2i;
+            yi[y2 + q] = t2r * w2i + t2i * w2r;
+            yr[y3 + q] = t3r * w3r - t3i * w3i;
+            yi[y3 + q] = t3r * w3i + t3i * w3r;
+        }
+    }
+}
+
+/**
+   Run the stages after the first, ping-ponging between @p a and @p b, and
+   return the array holding the result.
+*/
+static float * builtin_stages(const fft_plan_t *plan, float *a, float *b)
+{
+    const uint32_t half = plan->half;
+
+    uint32_t s = 2;
+    while (s < half) {
+        const uint32_t n = half / s;
+        if (n >= 4) {
+            builtin_stage4(plan, n / 4, s, a, a + half, b, b + half);
+            s *= 4;
+        } else {
+            builtin_stage(plan, n / 2, s, a, a + half, b, b + half);
+            s *= 2;
+        }
+        float *t = a;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+static void builtin_forward(const fft_plan_t *plan, float *input, fft_complex *output)
+{
+    const uint32_t half = plan->half;
+    const uint32_t m = half / 2;
+    float *out = (float*) output;
+
+    // first stage, reading the even and odd samples as complex points
+    for (uint32_t p = 0; p < m; p++) {
+        const float ar = input[2 * p];
+        const float ai = input[2 * p + 1];
+        const float br = input[2 * (p + m)];
+        const float bi = input[2 * (p + m) + 1];
+        const float wr = plan->twiddle_re[p];
+        const float wi = plan->twiddle_im[p];
+        const float dr = ar - br;
+        const float di = ai - bi;
+        out[2 * p] = ar + br;
+        out[half + 2 * p] = ai + bi;
+        out[2 * p + 1] = dr * wr - di * wi;
+        out[half + 2 * p + 1] = dr * wi + di * wr;
+    }
+
+    // the input is scratch from here on, the split needs the result in it
+    const float *z = builtin_stages(plan, out, input);
+    if (z != input) {
+        memcpy(input, z, sizeof(float) * 2 * half);
+        z = input;
+    }
+
+    const float *zr = z;
+    const float *zi = z + half;
+
+    for (uint32_t k = 0; k <= half; k++) {
+        const uint32_t j = (half - k) & (half - 1);
+        const uint32_t i = k & (half - 1);
+
+        // even part (Z[k] + conj(Z[-k])) / 2, odd part (Z[k] - conj(Z[-k])) / 2i
+        const float er = 0.5f * (zr[i] + zr[j]);
+        const float ei = 0.5f * (zi[i] - zi[j]);
+        const float odd_r = 0.5f * (zi[i] + zi[j]);
+        const float odd_i = -0.5f * (zr[i] - zr[j]);
+
+        const float wr = plan->split_re[k];
+        const float wi = plan->split_im[k];
+        output[k][0] = er + odd_r * wr - odd_i * wi;
+        output[k][1] = ei + odd_r * wi + odd_i * wr;
+    }
+}
+
+static void builtin_inverse(const fft_plan_t *plan, fft_complex *input, float *output)
+{
+    const uint32_t half = plan->half;
+    float *zr = output;
+    float *zi = output + half;
+
+    // merge the even and odd spectra, conjugated for a forward FFT
+    for (uint32_t k = 0; k < half; k++) {
+        const float ar = input[k][0];
+        const float br = input[half - k][0];
+
+        // like FFTW, the imaginary parts of the DC and Nyquist bins are ignored
+        const float ai = k ? input[k][1] : 0.0f;
+        const float bi = k ? -input[half - k][1] : 0.0f;
+
+        const float er = ar + br;
+        const float ei = ai + bi;
+        const float dr = ar - br;
+        const float di = ai - bi;
+
+        // odd part times exp(2 pi i k / size)
+        const float wr = plan->split_re[k];
+        const float wi = -plan->split_im[k];
+        const float odd_r = dr * wr - di * wi;
+        const float odd_i = dr * wi + di * wr;
+
+        zr[k] = er - odd_i;
+        zi[k] = -(ei + odd_r);
+    }
+
+    float *in = (float*) input;
+    builtin_stage(plan, half / 2, 1, zr, zi, in, in + half);
+
+    const float *z = builtin_stages(plan, in, output);
+    if (z == output) {
+        memcpy(in, z, sizeof(float) * 2 * half);
+        z = in;
+    }
+
+    // interleave and conjugate back
+    for (uint32_t n = 0; n < half; n++) {
+        output[2 * n] = z[n];
+        output[2 * n + 1] = -z[half + n];
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Plans
+
+static void plan_destroy(fft_plan_t *plan)
+{
+    if (!plan)
+        return;
+
+#ifdef HAVE_FFTW
+    if (plan->r2c)
+        fftwf_destroy_plan(plan->r2c);
+    if (plan->c2r)
+        fftwf_destroy_plan(plan->c2r);
+#endif
+    fft_free(plan->twiddle_re);
+    free(plan);
+}
+
+// called with the planner lock held
+static fft_plan_t * plan_create(fft_backend_t backend, uint32_t size, float *real, fft_complex *spectrum)
+{
+    if (!fft_backend_available(backend, size))
+        return NULL;
+
+    fft_plan_t *plan = (fft_plan_t*) calloc(1, sizeof(fft_plan_t));
+    if (!plan)
+        return NULL;
+
+    plan->size = size;
+    plan->backend = backend;
+
+    bool ok = false;
+    if (backend == FFT_BACKEND_BUILTIN) {
+        ok = builtin_init(plan);
+    }
+#ifdef HAVE_FFTW
+    else {
+        // wisdom only helps if it is asked for before estimating
+        if (wisdom_imported) {
+            plan->r2c = fftwf_plan_dft_r2c_1d(size, real, spectrum, FFTW_WISDOM_ONLY|FFTW_ESTIMATE);
+            plan->c2r = fftwf_plan_dft_c2r_1d(size, spectrum, real, FFTW_WISDOM_ONLY|FFTW_ESTIMATE);
+        }
+        if (!plan->r2c)
+            plan->r2c = fftwf_plan_dft_r2c_1d(size, real, spectrum, FFTW_ESTIMATE);
+        if (!plan->c2r)
+            plan->c2r = fftwf_plan_dft_c2r_1d(size, spectrum, real, FFTW_ESTIMATE);
+        ok = plan->r2c && plan->c2r;
+    }
+#endif
+
+    if (!ok) {
+        plan_destroy(plan);
+        return NULL;
+    }
+
+    return plan;
+}
+
+// best seconds per forward and inverse transform, on scratch arrays
+static double plan_time(const fft_plan_t *plan, float *real, fft_complex *spectrum)
+{
+    const uint32_t iterations = 1 + (1u << 15) / plan->size;
+    double best = INFINITY;
+
+    memset(real, 0, sizeof(float) * plan->size);
+    for (int run = 0; run < 5; run++) {
+        const double start = monotonic_seconds();
+        for (uint32_t i = 0; i < iterations; i++) {
+            fft_forward(plan, real, spectrum);
+            fft_inverse(plan, spectrum, real);
+        }
+        const double seconds = (monotonic_seconds() - start) / iterations;
+        if (seconds < best)
+            best = seconds;
+    }
+
+    return best;
+}
+
+static fft_backend_t requested_backend(void)
+{
+    const char *name = getenv(FFT_BACKEND_ENV);
+    if (name && !strcmp(name, "fftw"))
+        return FFT_BACKEND_FFTW;
+    if (name && !strcmp(name, "builtin"))
+        return FFT_BACKEND_BUILTIN;
+    return FFT_BACKEND_AUTO;
+}
+
+/**
+   Create a plan with the backend requested through the environment, or the
+   faster one on this machine for @p size.  Called with the planner lock held.
+*/
+static fft_plan_t * plan_select(uint32_t size, float *real, fft_complex *spectrum)
+{
+    const fft_backend_t requested = requested_backend();
+    if (requested != FFT_BACKEND_AUTO && fft_backend_available(requested, size))
+        return plan_create(requested, size, real, spectrum);
+
+    fft_plan_t *fftw = plan_create(FFT_BACKEND_FFTW, size, real, spectrum);
+    fft_plan_t *builtin = plan_create(FFT_BACKEND_BUILTIN, size, real, spectrum);
+    if (!fftw || !builtin)
+        return fftw ? fftw : builtin;
+
+    // time both on arrays of our own, the caller's may hold data
+    float *scratch_real = (float*) fft_malloc(sizeof(float) * size);
+    fft_complex *scratch_spectrum = (fft_complex*) fft_malloc(sizeof(fft_complex) * (size / 2 + 1));
+    bool use_builtin = false;
+    if (scratch_real && scratch_spectrum)
+        use_builtin = plan_time(builtin, scratch_real, scratch_spectrum) < plan_time(fftw, scratch_real, scratch_spectrum);
+    fft_free(scratch_real);
+    fft_free(scratch_spectrum);
+
+    if (use_builtin) {
+        plan_destroy(fftw);
+        return builtin;
+    }
+    plan_destroy(builtin);
+    return fftw;
+}
+
+/**
+   Return a plan for real FFTs of @p size on arrays with the alignment of
+   @p real and @p spectrum, making it if no engine uses one yet.
+
+   The backend is chosen when a size is first planned.  This must not be
+   called from the audio thread.
+*/
+const fft_plan_t * fft_plan(uint32_t size, float *real, fft_complex *spectrum)
+{
+    const int real_alignment = alignment_of(real);
+    const int spectrum_alignment = alignment_of(spectrum);
+
+    pthread_mutex_lock(&planner_lock);
+
+    fft_plan_t *plan;
+    for (plan = plan_cache; plan; plan = plan->next) {
+        if (plan->size == size && plan->real_alignment == real_alignment
+            && plan->spectrum_alignment == spectrum_alignment)
+            break;
+    }
+
+    if (!plan) {
+        plan = plan_select(size, real, spectrum);
+        if (!plan) {
+            pthread_mutex_unlock(&planner_lock);
+            return NULL;
+        }
+
+        plan->real_alignment = real_alignment;
+        plan->spectrum_alignment = spectrum_alignment;
+        plan->next = plan_cache;
+        plan_cache = plan;
+    }
+
+    ++plan->refcount;
+
+    pthread_mutex_unlock(&planner_lock);
+
+    return plan;
+}
+
+void fft_plan_release(const fft_plan_t *plan)
+{
+    if (!plan)
+        return;
+
+    pthread_mutex_lock(&planner_lock);
+    for (fft_plan_t **link = &plan_cache; *link; link = &(*link)->next) {
+        fft_plan_t *entry = *link;
+        if (entry == plan) {
+            if (--entry->refcount == 0) {
+                *link = entry->next;
+                plan_destroy(entry);
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&planner_lock);
+}
+
+fft_backend_t fft_plan_backend(const fft_plan_t *plan)
+{
+    return plan->backend;
+}
+
+/**
+   Unnormalized real FFT of plan->size samples into size / 2 + 1 bins.
+
+   The input array is used as scratch and is overwritten.
+*/
+void fft_forward(const fft_plan_t *plan, float *input, fft_complex *output)
+{
+#ifdef HAVE_FFTW
+    if (plan->backend == FFT_BACKEND_FFTW) {
+        fftwf_execute_dft_r2c(plan->r2c, input, output);
+        return;
+    }
+#endif
+    builtin_forward(plan, input, output);
+}
+
+/**
+   Unnormalized inverse of fft_forward(), the output is plan->size times the
+   signal.  The input array is overwritten.
+*/
+void fft_inverse(const fft_plan_t *plan, fft_complex *input, float *output)
+{
+#ifdef HAVE_FFTW
+    if (plan->backend == FFT_BACKEND_FFTW) {
+        fftwf_execute_dft_c2r(plan->c2r, input, output);
+        return;
+    }
+#endif
+    builtin_inverse(plan, input, output);
+}
+
+/**
+   Seconds per forward and inverse transform of @p size with @p backend, or
+   with the plan engines get for FFT_BACKEND_AUTO.  Negative if the backend
+   cannot handle the size.
+*/
+double fft_benchmark(fft_backend_t backend, uint32_t size)
+{
+    float *real = (float*) fft_malloc(sizeof(float) * size);
+    fft_complex *spectrum = (fft_complex*) fft_malloc(sizeof(fft_complex) * (size / 2 + 1));
+    double seconds = -1.0;
+
+    if (real && spectrum) {
+        if (backend == FFT_BACKEND_AUTO) {
+            const fft_plan_t *plan = fft_plan(size, real, spectrum);
+            if (plan) {
+                seconds = plan_time(plan, real, spectrum);
+                fft_plan_release(plan);
+            }
+        } else {
+            pthread_mutex_lock(&planner_lock);
+            fft_plan_t *plan = plan_create(backend, size, real, spectrum);
+            pthread_mutex_unlock(&planner_lock);
+            if (plan) {
+                seconds = plan_time(plan, real, spectrum);
+                pthread_mutex_lock(&planner_lock);
+                plan_destroy(plan);
+                pthread_mutex_unlock(&planner_lock);
+            }
+        }
+    }
+
+    fft_free(real);
+    fft_free(spectrum);
+
+    return seconds;
+}
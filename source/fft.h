@@ -0,0 +1,45 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// same layout as fftwf_complex, real and imaginary part
+typedef float fft_complex[2];
+
+/**
+   FFT implementations.  FFTW is only available when built with HAVE_FFTW,
+   the built-in one handles power of two sizes from FFT_MIN_BUILTIN_SIZE.
+*/
+typedef enum {
+    FFT_BACKEND_AUTO,
+    FFT_BACKEND_FFTW,
+    FFT_BACKEND_BUILTIN
+} fft_backend_t;
+
+#define FFT_MIN_BUILTIN_SIZE 16
+
+// forces a backend instead of benchmarking them, "fftw" or "builtin"
+#define FFT_BACKEND_ENV "CABSIM_FFT"
+
+typedef struct FFT_PLAN_T fft_plan_t;
+
+bool fft_import_wisdom(const char *path);
+
+void * fft_malloc(size_t size);
+void fft_free(void *ptr);
+
+bool fft_backend_available(fft_backend_t backend, uint32_t size);
+const char * fft_backend_name(fft_backend_t backend);
+
+const fft_plan_t * fft_plan(uint32_t size, float *real, fft_complex *spectrum);
+void fft_plan_release(const fft_plan_t *plan);
+fft_backend_t fft_plan_backend(const fft_plan_t *plan);
+
+void fft_forward(const fft_plan_t *plan, float *input, fft_complex *output);
+void fft_inverse(const fft_plan_t *plan, fft_complex *input, float *output);
+
+double fft_benchmark(fft_backend_t backend, uint32_t size);
+
+#endif // FFT_H
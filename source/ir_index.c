@@ -0,0 +1,456 @@
+/*
+  Index of IR files: header metadata, a trimmed length estimate and a hash
+  of the contents for every IR below some directories.  Updates only probe
+  files whose mtime or size changed since they were indexed.
+*/
+
+#include "ir_index.h"
+
+#include <dirent.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <sndfile.h>
+
+// first line of the index file
+#define INDEX_HEADER "cabsim-index 1"
+
+// deepest directory level an update descends to
+#define INDEX_MAX_DEPTH 16
+
+bool
+ir_index_audio_file(const char* name)
+{
+    static const char* const extensions[] = { ".wav", ".flac", ".aif", ".aiff", ".ogg", NULL };
+
+    const char* const dot = strrchr(name, '.');
+    for (int i = 0; dot && extensions[i]; i++) {
+        if (!strcasecmp(dot, extensions[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+ir_index_t*
+ir_index_new(void)
+{
+    return (ir_index_t*)calloc(1, sizeof(ir_index_t));
+}
+
+ir_index_t*
+ir_index_copy(const ir_index_t* index)
+{
+    ir_index_t* const copy = ir_index_new();
+    if (!copy) {
+        return NULL;
+    }
+
+    copy->entries = (ir_index_entry_t*)malloc(sizeof(ir_index_entry_t) * (index->count ? index->count : 1));
+    if (!copy->entries) {
+        free(copy);
+        return NULL;
+    }
+    copy->capacity = index->count ? index->count : 1;
+
+    for (uint32_t i = 0; i < index->count; i++) {
+        copy->entries[i]      = index->entries[i];
+        copy->entries[i].path = strdup(index->entries[i].path);
+        if (!copy->entries[i].path) {
+            ir_index_free(copy);
+            return NULL;
+        }
+        copy->count++;
+    }
+    return copy;
+}
+
+void
+ir_index_free(ir_index_t* index)
+{
+    if (!index) {
+        return;
+    }
+    for (uint32_t i = 0; i < index->count; i++) {
+        free(index->entries[i].path);
+    }
+    free(index->entries);
+    free(index);
+}
+
+// position of @p path, or where it would be inserted
+static uint32_t
+find_position(const ir_index_t* index, const char* path, bool* found)
+{
+    uint32_t low  = 0;
+    uint32_t high = index->count;
+    while (low < high) {
+        const uint32_t mid = low + (high - low) / 2;
+        const int      cmp = strcmp(index->entries[mid].path, path);
+        if (cmp == 0) {
+            *found = true;
+            return mid;
+        }
+        if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    *found = false;
+    return low;
+}
+
+/**
+   The entry of the file at @p path, or NULL.
+*/
+const ir_index_entry_t*
+ir_index_find(const ir_index_t* index, const char* path)
+{
+    bool           found;
+    const uint32_t pos = find_position(index, path, &found);
+    return found ? &index->entries[pos] : NULL;
+}
+
+/**
+   The entry of the file at @p path if it is still valid for the file's
+   current status @p st, or NULL.
+*/
+const ir_index_entry_t*
+ir_index_lookup(const ir_index_t* index, const char* path, const struct stat* st)
+{
+    const ir_index_entry_t* const entry = ir_index_find(index, path);
+    if (entry && entry->mtime == (int64_t)st->st_mtime && entry->size == (int64_t)st->st_size) {
+        return entry;
+    }
+    return NULL;
+}
+
+// takes over the path of @p entry, which replaces one with the same path
+static bool
+insert_entry(ir_index_t* index, const ir_index_entry_t* entry)
+{
+    bool           found;
+    const uint32_t pos = find_position(index, entry->path, &found);
+    if (found) {
+        free(index->entries[pos].path);
+        index->entries[pos] = *entry;
+        return true;
+    }
+
+    if (index->count == index->capacity) {
+        const uint32_t          capacity = index->capacity ? 2 * index->capacity : 64;
+        ir_index_entry_t* const entries  = (ir_index_entry_t*)realloc(index->entries,
+                sizeof(ir_index_entry_t) * capacity);
+        if (!entries) {
+            return false;
+        }
+        index->entries  = entries;
+        index->capacity = capacity;
+    }
+
+    memmove(&index->entries[pos + 1], &index->entries[pos], sizeof(ir_index_entry_t) * (index->count - pos));
+    index->entries[pos] = *entry;
+    index->count++;
+    return true;
+}
+
+static int
+compare_entries(const void* a, const void* b)
+{
+    return strcmp(((const ir_index_entry_t*)a)->path, ((const ir_index_entry_t*)b)->path);
+}
+
+/**
+   Add the entries of the index file at @p path, replacing entries of the
+   same files.  Returns false if it could not be read.
+*/
+bool
+ir_index_read(ir_index_t* index, const char* path)
+{
+    FILE* const file = fopen(path, "r");
+    if (!file) {
+        return false;
+    }
+
+    char line[4096 + 128];
+    if (!fgets(line, sizeof(line), file) || strncmp(line, INDEX_HEADER "\n", sizeof(INDEX_HEADER))) {
+        fclose(file);
+        return false;
+    }
+
+    // entries are appended and sorted once, files are written sorted
+    ir_index_t read = { NULL, 0, 0 };
+    while (fgets(line, sizeof(line), file)) {
+        ir_index_entry_t   entry = { 0 };
+        unsigned long long hash, frames, trimmed;
+        long long          mtime, size;
+        int                offset = 0;
+        if (sscanf(line, "%llx %lld %lld %u %u %llu %llu %n", &hash, &mtime, &size,
+                   &entry.channels, &entry.samplerate, &frames, &trimmed, &offset) != 7 || !offset) {
+            continue;
+        }
+
+        size_t len = strlen(line + offset);
+        while (len && line[offset + len - 1] == '\n') {
+            line[offset + --len] = 0;
+        }
+        if (!len) {
+            continue;
+        }
+
+        entry.hash           = hash;
+        entry.mtime          = mtime;
+        entry.size           = size;
+        entry.frames         = frames;
+        entry.trimmed_frames = trimmed;
+        entry.path           = strdup(line + offset);
+
+        if (read.count == read.capacity) {
+            const uint32_t          capacity = read.capacity ? 2 * read.capacity : 64;
+            ir_index_entry_t* const entries  = (ir_index_entry_t*)realloc(read.entries,
+                    sizeof(ir_index_entry_t) * capacity);
+            if (!entries) {
+                free(entry.path);
+                break;
+            }
+            read.entries  = entries;
+            read.capacity = capacity;
+        }
+        if (entry.path) {
+            read.entries[read.count++] = entry;
+        }
+    }
+    fclose(file);
+
+    qsort(read.entries, read.count, sizeof(ir_index_entry_t), compare_entries);
+    for (uint32_t i = 0; i < read.count; i++) {
+        if (!insert_entry(index, &read.entries[i])) {
+            free(read.entries[i].path);
+        }
+    }
+    free(read.entries);
+    return true;
+}
+
+/**
+   Write the index to @p path, replacing the file at once so that readers
+   never see a partial index.
+*/
+bool
+ir_index_write(const ir_index_t* index, const char* path)
+{
+    // create the directory, but not its parents
+    char* const dir   = strdup(path);
+    char* const slash = dir ? strrchr(dir, '/') : NULL;
+    if (slash && slash != dir) {
+        *slash = 0;
+        mkdir(dir, 0755);
+    }
+    free(dir);
+
+    char* const tmp = (char*)malloc(strlen(path) + 5);
+    if (!tmp) {
+        return false;
+    }
+    sprintf(tmp, "%s.tmp", path);
+
+    FILE* const file = fopen(tmp, "w");
+    bool        ok   = file != NULL;
+    if (file) {
+        fprintf(file, "%s\n", INDEX_HEADER);
+        for (uint32_t i = 0; i < index->count; i++) {
+            const ir_index_entry_t* const entry = &index->entries[i];
+            fprintf(file, "%016llx %lld %lld %u %u %llu %llu %s\n", (unsigned long long)entry->hash,
+                    (long long)entry->mtime, (long long)entry->size, entry->channels, entry->samplerate,
+                    (unsigned long long)entry->frames, (unsigned long long)entry->trimmed_frames, entry->path);
+        }
+        ok = fclose(file) == 0 && rename(tmp, path) == 0;
+    }
+
+    if (!ok) {
+        remove(tmp);
+    }
+    free(tmp);
+    return ok;
+}
+
+// FNV-1a of the whole file, false if it could not be read
+static bool
+hash_file(const char* path, uint64_t* hash)
+{
+    FILE* const file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+
+    uint64_t      h = 0xcbf29ce484222325ull;
+    unsigned char buffer[65536];
+    size_t        got;
+    while ((got = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        for (size_t i = 0; i < got; i++) {
+            h = (h ^ buffer[i]) * 0x100000001b3ull;
+        }
+    }
+    const bool ok = !ferror(file);
+    fclose(file);
+
+    *hash = h;
+    return ok;
+}
+
+/**
+   Fill @p entry for the file at @p path with status @p st.  Everything but
+   the hash stays zero if libsndfile can't read the file.
+*/
+static void
+probe_file(const char* path, const struct stat* st, ir_index_entry_t* entry)
+{
+    entry->mtime = st->st_mtime;
+    entry->size  = st->st_size;
+    if (!hash_file(path, &entry->hash)) {
+        entry->hash = 0;
+    }
+
+    SF_INFO info;
+    memset(&info, 0, sizeof(info));
+    SNDFILE* const sndfile = sf_open(path, SFM_READ, &info);
+    if (!sndfile) {
+        return;
+    }
+
+    entry->channels       = (uint32_t)info.channels;
+    entry->samplerate     = (uint32_t)info.samplerate;
+    entry->frames         = (uint64_t)info.frames;
+    entry->trimmed_frames = (uint64_t)info.frames;
+
+    // the first channel is the one the loader uses
+    float* const data = info.frames > 0 && info.channels > 0
+        ? (float*)malloc(sizeof(float) * info.frames * info.channels) : NULL;
+    if (data) {
+        const sf_count_t frames = sf_readf_float(sndfile, data, info.frames);
+
+        float peak = 0.0f;
+        for (sf_count_t i = 0; i < frames; i++) {
+            peak = fmaxf(peak, fabsf(data[i * info.channels]));
+        }
+
+        const float threshold = peak * powf(10.0f, IR_INDEX_TRIM_DB * 0.05f);
+        sf_count_t  trimmed   = frames;
+        while (trimmed > 0 && fabsf(data[(trimmed - 1) * info.channels]) <= threshold) {
+            trimmed--;
+        }
+        entry->trimmed_frames = (uint64_t)trimmed;
+        free(data);
+    }
+    sf_close(sndfile);
+}
+
+// probe the audio files below @p dir that are new or changed, returns how many
+static uint32_t
+update_dir(ir_index_t* index, const char* dir, const bool* stop, int depth)
+{
+    DIR* const handle = opendir(dir);
+    if (!handle) {
+        return 0;
+    }
+
+    uint32_t       probed = 0;
+    struct dirent* item;
+    while ((item = readdir(handle)) && !__atomic_load_n(stop, __ATOMIC_RELAXED)) {
+        if (item->d_name[0] == '.') {
+            continue;
+        }
+
+        char* const path = (char*)malloc(strlen(dir) + strlen(item->d_name) + 2);
+        if (!path) {
+            break;
+        }
+        sprintf(path, "%s/%s", dir, item->d_name);
+
+        struct stat st;
+        if (stat(path, &st) || strchr(path, '\n')) {
+            free(path);
+            continue;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            if (depth < INDEX_MAX_DEPTH) {
+                probed += update_dir(index, path, stop, depth + 1);
+            }
+            free(path);
+            continue;
+        }
+
+        bool           found;
+        const uint32_t pos = find_position(index, path, &found);
+        if (!S_ISREG(st.st_mode) || !ir_index_audio_file(item->d_name)) {
+            free(path);
+        } else if (found && index->entries[pos].mtime == (int64_t)st.st_mtime
+                   && index->entries[pos].size == (int64_t)st.st_size) {
+            index->entries[pos].seen = true;
+            free(path);
+        } else {
+            ir_index_entry_t entry = { 0 };
+            entry.path = path;
+            entry.seen = true;
+            probe_file(path, &st, &entry);
+            if (insert_entry(index, &entry)) {
+                probed++;
+            } else {
+                free(path);
+            }
+        }
+    }
+    closedir(handle);
+
+    return probed;
+}
+
+/**
+   Bring the entries of the files below @p dir up to date: files that are
+   new or whose mtime or size changed are probed, entries of files that are
+   gone are removed.  Blocks while reading files, so it is meant for a
+   background thread, which can end it early by setting @p stop.
+
+   Returns the number of entries that were added, changed or removed.
+*/
+uint32_t
+ir_index_update(ir_index_t* index, const char* dir, const bool* stop)
+{
+    size_t dir_len = strlen(dir);
+    while (dir_len > 1 && dir[dir_len - 1] == '/') {
+        --dir_len;
+    }
+    char* const root = strndup(dir, dir_len);
+    if (!root) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < index->count; i++) {
+        index->entries[i].seen = false;
+    }
+
+    uint32_t changed = update_dir(index, root, stop, 0);
+
+    // an update that was stopped did not see every file
+    if (!__atomic_load_n(stop, __ATOMIC_RELAXED)) {
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < index->count; i++) {
+            ir_index_entry_t* const entry = &index->entries[i];
+            if (!entry->seen && !strncmp(entry->path, root, dir_len) && entry->path[dir_len] == '/') {
+                free(entry->path);
+                changed++;
+            } else {
+                index->entries[kept++] = *entry;
+            }
+        }
+        index->count = kept;
+    }
+
+    free(root);
+    return changed;
+}
@@ -0,0 +1,50 @@
+#ifndef IR_INDEX_H
+#define IR_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// the trimmed length ends where an IR stays this far below its peak
+#define IR_INDEX_TRIM_DB -60.0f
+
+/**
+   What the index knows about one IR file, at the mtime and size it had when
+   it was probed.  Files libsndfile can't read are kept with no channels, so
+   they are not probed again until they change.
+*/
+typedef struct {
+    char*    path;
+    int64_t  mtime;
+    int64_t  size;
+    uint64_t hash;            // FNV-1a of the file contents
+    uint32_t channels;
+    uint32_t samplerate;
+    uint64_t frames;
+    uint64_t trimmed_frames;  // frames up to the last one above IR_INDEX_TRIM_DB
+    bool     seen;            // found by the running update
+} ir_index_entry_t;
+
+/**
+   Index of the IR files below some directories, sorted by path.
+*/
+typedef struct {
+    ir_index_entry_t* entries;
+    uint32_t          count;
+    uint32_t          capacity;
+} ir_index_t;
+
+bool ir_index_audio_file(const char* name);
+
+ir_index_t* ir_index_new(void);
+ir_index_t* ir_index_copy(const ir_index_t* index);
+void ir_index_free(ir_index_t* index);
+
+bool ir_index_read(ir_index_t* index, const char* path);
+bool ir_index_write(const ir_index_t* index, const char* path);
+
+const ir_index_entry_t* ir_index_find(const ir_index_t* index, const char* path);
+const ir_index_entry_t* ir_index_lookup(const ir_index_t* index, const char* path, const struct stat* st);
+uint32_t ir_index_update(ir_index_t* index, const char* dir, const bool* stop);
+
+#endif // IR_INDEX_H
@@ -0,0 +1,108 @@
+/*
+  Resampler function is taken from https://github.com/cpuimage/resampler/
+  Copyright (c) 2019 Zhihan Gao
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "ir_loader.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint64_t
+Resample_f32(const float *input, float *output, int inSampleRate,
+        int outSampleRate, uint64_t inputSize, uint32_t channels)
+{
+    if (input == NULL)
+        return 0;
+    uint64_t outputSize = inputSize * outSampleRate / inSampleRate;
+    if (output == NULL)
+        return outputSize;
+    double stepDist = ((double) inSampleRate / (double) outSampleRate);
+    const uint64_t fixedFraction = (1LL << 32);
+    const double normFixed = (1.0 / (1LL << 32));
+    uint64_t step = ((uint64_t) (stepDist * fixedFraction + 0.5));
+    uint64_t curOffset = 0;
+    // the last frame is held instead of interpolating past the end
+    const float *last = input + (inputSize - 1) * channels;
+    for (uint32_t i = 0; i < outputSize; i += 1) {
+        const uint32_t next = input < last ? channels : 0;
+        for (uint32_t c = 0; c < channels; c += 1) {
+            *output++ = (float) (input[c] + (input[c + next] - input[c]) * (
+                        (double) (curOffset >> 32) + ((curOffset & (fixedFraction - 1)) * normFixed)));
+        }
+        curOffset += step;
+        input += (curOffset >> 32) * channels;
+        if (input > last)
+            input = last;
+        curOffset &= (fixedFraction - 1);
+    }
+    return outputSize;
+}
+
+static sf_count_t
+convert_to_mono(float *data, sf_count_t num_input_frames, uint32_t channels)
+{
+    sf_count_t mono_index = 0;
+    for (sf_count_t i = 0; i < num_input_frames * channels; i+=channels) {
+        data[mono_index++] = data[i];
+    }
+
+    sf_count_t num_output_frames = mono_index;
+
+    return num_output_frames;
+}
+
+float* ir_load(const char* path, int samplerate, SF_INFO* info)
+{
+    memset(info, 0, sizeof(SF_INFO));
+    SNDFILE* const sndfile = sf_open(path, SFM_READ, info);
+
+    if (!sndfile || !info->frames) {
+        if (sndfile)
+            sf_close(sndfile);
+        return NULL;
+    }
+
+    // Read data
+    float* const data = malloc(sizeof(float) * (info->frames * info->channels));
+    if (!data) {
+        sf_close(sndfile);
+        return NULL;
+    }
+    sf_seek(sndfile, 0ul, SEEK_SET);
+    sf_read_float(sndfile, data, info->frames * info->channels);
+    sf_close(sndfile);
+
+    //When IR has multiple channels, only use first channel
+    if (info->channels != 1) {
+        info->frames = convert_to_mono(data, info->frames, info->channels);
+        info->channels = 1;
+    }
+
+    //apply samplerate conversion if needed
+    if (info->samplerate == samplerate)
+        return data;
+
+    uint64_t targetSampleCount = Resample_f32(data, 0, info->samplerate, samplerate, (uint64_t)info->frames, 1);
+    float* const resampled_data = malloc(targetSampleCount * sizeof(float));
+    if (!resampled_data) {
+        free(data);
+        return NULL;
+    }
+    info->frames = Resample_f32(data, resampled_data, info->samplerate, samplerate, (uint64_t)info->frames, 1);
+    free(data);
+
+    return resampled_data;
+}
@@ -0,0 +1,21 @@
+#ifndef IR_LOADER_H
+#define IR_LOADER_H
+
+#include <sndfile.h>
+
+// only the first part of an IR is used, 42.7 ms at 48 kHz
+#define IR_MAX_LENGTH 2048
+
+// the plugin input is scaled down by this to leave headroom for loud IRs
+#define IR_HEADROOM   0.2f
+
+/**
+   Read an IR file, keep its first channel and resample it to @p samplerate.
+
+   Returns the samples, or NULL if the file could not be read.  @p info is
+   filled by libsndfile, with frames updated to the length after resampling.
+   Not realtime safe.
+*/
+float* ir_load(const char* path, int samplerate, SF_INFO* info);
+
+#endif // IR_LOADER_H
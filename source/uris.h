@@ -25,19 +25,52 @@
 
 #define CABSIM_URI "http://moddevices.com/plugins/mod-devel/cabsim-IR-loader"
 #define CABSIM__ir CABSIM_URI "#ir"
+#define CABSIM__ir2 CABSIM_URI "#ir2"
 #define CABSIM__applyImpulseResponse CABSIM_URI "#applyImpulseResponse"
-#define CABSIM__freeImpulseResponse  CABSIM_URI "#freeImpulseResponse"
+#define CABSIM__configureEngine      CABSIM_URI "#configureEngine"
+#define CABSIM__freeConvolution      CABSIM_URI "#freeConvolution"
+#define CABSIM__bank                 CABSIM_URI "#bank"
+#define CABSIM__bankLoaded           CABSIM_URI "#bankLoaded"
+#define CABSIM__bankSize             CABSIM_URI "#bankSize"
+#define CABSIM__bankMemory           CABSIM_URI "#bankMemory"
+#define CABSIM__bankProgress         CABSIM_URI "#bankProgress"
+#define CABSIM__tailBlockSize        CABSIM_URI "#tailBlockSize"
+#define CABSIM__partitionLayout      CABSIM_URI "#partitionLayout"
+#define CABSIM__restoreState         CABSIM_URI "#restoreState"
+#define CABSIM__inputPeak            CABSIM_URI "#inputPeak"
+#define CABSIM__inputRms             CABSIM_URI "#inputRms"
+#define CABSIM__outputPeak           CABSIM_URI "#outputPeak"
+#define CABSIM__outputRms            CABSIM_URI "#outputRms"
+#define CABSIM__outputClips          CABSIM_URI "#outputClips"
 
 typedef struct {
 	LV2_URID atom_Float;
+	LV2_URID atom_Int;
+	LV2_URID atom_Long;
 	LV2_URID atom_Path;
 	LV2_URID atom_Resource;
 	LV2_URID atom_Sequence;
 	LV2_URID atom_URID;
+	LV2_URID atom_Vector;
 	LV2_URID atom_eventTransfer;
 	LV2_URID cab_applyImpulseResponse;
+	LV2_URID cab_bank;
+	LV2_URID cab_bankLoaded;
+	LV2_URID cab_bankMemory;
+	LV2_URID cab_bankProgress;
+	LV2_URID cab_bankSize;
+	LV2_URID cab_configureEngine;
 	LV2_URID cab_ir;
-	LV2_URID cab_freeImpulseResponse;
+	LV2_URID cab_ir2;
+	LV2_URID cab_inputPeak;
+	LV2_URID cab_inputRms;
+	LV2_URID cab_outputClips;
+	LV2_URID cab_outputPeak;
+	LV2_URID cab_outputRms;
+	LV2_URID cab_partitionLayout;
+	LV2_URID cab_restoreState;
+	LV2_URID cab_tailBlockSize;
+	LV2_URID cab_freeConvolution;
 	LV2_URID midi_Event;
 	LV2_URID param_gain;
 	LV2_URID patch_Get;
@@ -50,14 +83,32 @@ static inline void
 map_cabsim_uris(LV2_URID_Map* map, CabsimURIs* uris)
 {
 	uris->atom_Float               = map->map(map->handle, LV2_ATOM__Float);
+	uris->atom_Int                 = map->map(map->handle, LV2_ATOM__Int);
+	uris->atom_Long                = map->map(map->handle, LV2_ATOM__Long);
 	uris->atom_Path                = map->map(map->handle, LV2_ATOM__Path);
 	uris->atom_Resource            = map->map(map->handle, LV2_ATOM__Resource);
 	uris->atom_Sequence            = map->map(map->handle, LV2_ATOM__Sequence);
 	uris->atom_URID                = map->map(map->handle, LV2_ATOM__URID);
+	uris->atom_Vector              = map->map(map->handle, LV2_ATOM__Vector);
 	uris->atom_eventTransfer       = map->map(map->handle, LV2_ATOM__eventTransfer);
 	uris->cab_applyImpulseResponse = map->map(map->handle, CABSIM__applyImpulseResponse);
-	uris->cab_freeImpulseResponse  = map->map(map->handle, CABSIM__freeImpulseResponse);
+	uris->cab_bank                 = map->map(map->handle, CABSIM__bank);
+	uris->cab_bankLoaded           = map->map(map->handle, CABSIM__bankLoaded);
+	uris->cab_bankMemory           = map->map(map->handle, CABSIM__bankMemory);
+	uris->cab_bankProgress         = map->map(map->handle, CABSIM__bankProgress);
+	uris->cab_bankSize             = map->map(map->handle, CABSIM__bankSize);
+	uris->cab_configureEngine      = map->map(map->handle, CABSIM__configureEngine);
+	uris->cab_freeConvolution      = map->map(map->handle, CABSIM__freeConvolution);
 	uris->cab_ir                   = map->map(map->handle, CABSIM__ir);
+	uris->cab_ir2                  = map->map(map->handle, CABSIM__ir2);
+	uris->cab_inputPeak            = map->map(map->handle, CABSIM__inputPeak);
+	uris->cab_inputRms             = map->map(map->handle, CABSIM__inputRms);
+	uris->cab_outputClips          = map->map(map->handle, CABSIM__outputClips);
+	uris->cab_outputPeak           = map->map(map->handle, CABSIM__outputPeak);
+	uris->cab_outputRms            = map->map(map->handle, CABSIM__outputRms);
+	uris->cab_partitionLayout      = map->map(map->handle, CABSIM__partitionLayout);
+	uris->cab_restoreState         = map->map(map->handle, CABSIM__restoreState);
+	uris->cab_tailBlockSize        = map->map(map->handle, CABSIM__tailBlockSize);
 	uris->midi_Event               = map->map(map->handle, LV2_MIDI__MidiEvent);
 	uris->param_gain               = map->map(map->handle, LV2_PARAMETERS__gain);
 	uris->patch_Get                = map->map(map->handle, LV2_PATCH__Get);
@@ -76,6 +127,7 @@ map_cabsim_uris(LV2_URID_Map* map, CabsimURIs* uris)
 static inline LV2_Atom*
 write_set_file(LV2_Atom_Forge*    forge,
                const CabsimURIs* uris,
+               const LV2_URID     property,
                const char*        filename,
                const uint32_t     filename_len)
 {
@@ -84,7 +136,7 @@ write_set_file(LV2_Atom_Forge*    forge,
 		forge, &frame, 0, uris->patch_Set);
 
 	lv2_atom_forge_key(forge, uris->patch_property);
-	lv2_atom_forge_urid(forge, uris->cab_ir);
+	lv2_atom_forge_urid(forge, property);
 	lv2_atom_forge_key(forge, uris->patch_value);
 	lv2_atom_forge_path(forge, filename, filename_len + 1);
 
@@ -93,9 +145,82 @@ write_set_file(LV2_Atom_Forge*    forge,
 	return set;
 }
 
+/**
+ * Write a patch:Set of an integer @p property to @p forge.
+ */
+static inline LV2_Atom*
+write_set_int(LV2_Atom_Forge*    forge,
+              const CabsimURIs* uris,
+              const LV2_URID     property,
+              const int32_t      value)
+{
+	LV2_Atom_Forge_Frame frame;
+	LV2_Atom* set = (LV2_Atom*)lv2_atom_forge_object(
+		forge, &frame, 0, uris->patch_Set);
+
+	lv2_atom_forge_key(forge, uris->patch_property);
+	lv2_atom_forge_urid(forge, property);
+	lv2_atom_forge_key(forge, uris->patch_value);
+	lv2_atom_forge_int(forge, value);
+
+	lv2_atom_forge_pop(forge, &frame);
+
+	return set;
+}
+
+/**
+ * Write a patch:Set of a float @p property to @p forge.
+ */
+static inline LV2_Atom*
+write_set_float(LV2_Atom_Forge*    forge,
+                const CabsimURIs* uris,
+                const LV2_URID     property,
+                const float        value)
+{
+	LV2_Atom_Forge_Frame frame;
+	LV2_Atom* set = (LV2_Atom*)lv2_atom_forge_object(
+		forge, &frame, 0, uris->patch_Set);
+
+	lv2_atom_forge_key(forge, uris->patch_property);
+	lv2_atom_forge_urid(forge, property);
+	lv2_atom_forge_key(forge, uris->patch_value);
+	lv2_atom_forge_float(forge, value);
+
+	lv2_atom_forge_pop(forge, &frame);
+
+	return set;
+}
+
+/**
+ * Write a patch:Set of a long integer @p property to @p forge.
+ */
+static inline LV2_Atom*
+write_set_long(LV2_Atom_Forge*    forge,
+               const CabsimURIs* uris,
+               const LV2_URID     property,
+               const int64_t      value)
+{
+	LV2_Atom_Forge_Frame frame;
+	LV2_Atom* set = (LV2_Atom*)lv2_atom_forge_object(
+		forge, &frame, 0, uris->patch_Set);
+
+	lv2_atom_forge_key(forge, uris->patch_property);
+	lv2_atom_forge_urid(forge, property);
+	lv2_atom_forge_key(forge, uris->patch_value);
+	lv2_atom_forge_long(forge, value);
+
+	lv2_atom_forge_pop(forge, &frame);
+
+	return set;
+}
+
+/**
+ * Read the path and property of a patch:Set of an ir or the bank.
+ */
 static inline const LV2_Atom*
 read_set_file(const CabsimURIs*     uris,
-              const LV2_Atom_Object* obj)
+              const LV2_Atom_Object* obj,
+              LV2_URID*              key)
 {
 	if (obj->body.otype != uris->patch_Set) {
 		fprintf(stderr, "Ignoring unknown message type %d\n", obj->body.otype);
@@ -111,11 +236,15 @@ read_set_file(const CabsimURIs*     uris,
 	} else if (property->type != uris->atom_URID) {
 		fprintf(stderr, "Malformed set message has non-URID property.\n");
 		return NULL;
-	} else if (((const LV2_Atom_URID*)property)->body != uris->cab_ir) {
+	} else if (((const LV2_Atom_URID*)property)->body != uris->cab_ir
+	           && ((const LV2_Atom_URID*)property)->body != uris->cab_ir2
+	           && ((const LV2_Atom_URID*)property)->body != uris->cab_bank) {
 		fprintf(stderr, "Set message for unknown property.\n");
 		return NULL;
 	}
 
+	*key = ((const LV2_Atom_URID*)property)->body;
+
 	/* Get value. */
 	const LV2_Atom* file_path = NULL;
 	lv2_atom_object_get(obj, uris->patch_value, &file_path, 0);